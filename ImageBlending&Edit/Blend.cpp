@@ -0,0 +1,100 @@
+#include "Blend.h"
+#include "Simd.h"
+#include <cstring>
+
+const char* BlendModeName(BlendMode mode) {
+	switch (mode) {
+	case BlendMode::Multiply: return "multiply";
+	case BlendMode::Screen: return "screen";
+	case BlendMode::Overlay: return "overlay";
+	case BlendMode::Add: return "add";
+	case BlendMode::Difference: return "difference";
+	default: return "normal";
+	}
+}
+
+ScanlineBlender GetScanlineBlender(BlendMode mode) {
+	switch (mode) {
+	case BlendMode::Multiply: return BlendScanline<SeparableKernel<MultiplyMix>>;
+	case BlendMode::Screen: return BlendScanline<SeparableKernel<ScreenMix>>;
+	case BlendMode::Overlay: return BlendScanline<SeparableKernel<OverlayMix>>;
+	case BlendMode::Add: return BlendScanline<SeparableKernel<AddMix>>;
+	case BlendMode::Difference: return BlendScanline<SeparableKernel<DifferenceMix>>;
+	default: return BlendScanline<NormalKernel>;
+	}
+}
+
+void MakeOpacityTables(unsigned char opacity, OpacityTables& tables) {
+	float as = opacity / 255.0f;
+	for (int i = 0; i < 256; ++i) {
+		float ab = i / 255.0f;
+		float ao = as + ab * (1 - as);
+		tables.alpha[i] = static_cast<unsigned char>(ao * 255 + 0.5f);
+		// a fully transparent result keeps the (transparent) backdrop
+		tables.weight[i] = ao > 0 ? static_cast<unsigned short>(as / ao * 256 + 0.5f) : 0;
+	}
+}
+
+// One pixel as a 32-bit word, two channels to a multiply. The source
+// alpha is forced opaque, so the result keeps the backdrop's alpha byte
+// when that is opaque.
+static inline void BlendPixel8(const RGBApixel* src, RGBApixel* dst, unsigned int weight, unsigned int opaque) {
+	unsigned int rest = 256 - weight;
+	unsigned int s, d;
+	std::memcpy(&s, src, 4);
+	std::memcpy(&d, dst, 4);
+	s |= opaque;
+	unsigned int evens = ((s & 0x00FF00FF) * weight + (d & 0x00FF00FF) * rest + 0x00800080) >> 8;
+	unsigned int odds = ((s >> 8) & 0x00FF00FF) * weight + ((d >> 8) & 0x00FF00FF) * rest + 0x00800080;
+	d = (evens & 0x00FF00FF) | (odds & 0xFF00FF00);
+	std::memcpy(dst, &d, 4);
+}
+
+// Blends pixels at one weight for as long as the backdrop stays opaque;
+// returns how many it did. With SSE2 four pixels go through at once as
+// 16-bit lanes.
+static int BlendOpaqueRun8(const RGBApixel* src, RGBApixel* dst, int n, unsigned int weight, unsigned int opaque) {
+	int j = 0;
+#ifdef SIMD_SSE2
+	__m128i opaque4 = _mm_set1_epi32((int)opaque);
+	__m128i weight8 = _mm_set1_epi16((short)weight);
+	__m128i rest8 = _mm_set1_epi16((short)(256 - weight));
+	__m128i half = _mm_set1_epi16(128);
+	__m128i zero = _mm_setzero_si128();
+	for (; j + 4 <= n; j += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + j));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(d, opaque4), opaque4)) != 0xFFFF)
+			break;
+		__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i*)(src + j)), opaque4);
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), weight8),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), rest8)), half);
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), weight8),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), rest8)), half);
+		_mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+	}
+#endif
+	for (; j < n && dst[j].Alpha == 255; ++j) {
+		BlendPixel8(src + j, dst + j, weight, opaque);
+	}
+	return j;
+}
+
+void BlendScanline8(const RGBApixel* src, RGBApixel* dst, int n, const OpacityTables& tables) {
+	unsigned int opaque;
+	RGBApixel opaquePixel = { 0, 0, 0, 255 };
+	std::memcpy(&opaque, &opaquePixel, 4);
+	int j = 0;
+	while (j < n) {
+		// runs over an opaque backdrop, the usual case, stay opaque
+		j += BlendOpaqueRun8(src + j, dst + j, n - j, tables.weight[255], opaque);
+		if (j == n)
+			break;
+		ebmpBYTE alpha = tables.alpha[dst[j].Alpha];
+		BlendPixel8(src + j, dst + j, tables.weight[dst[j].Alpha], opaque);
+		dst[j].Alpha = alpha;
+		if (alpha == 0) {
+			dst[j].Red = dst[j].Green = dst[j].Blue = 0;  // Fully transparent
+		}
+		++j;
+	}
+}
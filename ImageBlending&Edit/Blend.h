@@ -0,0 +1,111 @@
+#pragma once
+#include "EasyBMP.h"
+#include "Pixel.h"
+
+// How a layer combines with the layers below it.
+enum class BlendMode {
+	Normal,
+	Multiply,
+	Screen,
+	Overlay,
+	Add,
+	Difference,
+	Count
+};
+
+const char* BlendModeName(BlendMode mode);
+
+// Straight-alpha "over": fg composited onto bg.
+inline pixel BlendPixel(const pixel& fg, const pixel& bg) {
+	pixel blended;
+	blended.a = fg.a + bg.a * (1 - fg.a);
+	if (blended.a > 0) {
+		blended.r = (fg.r * fg.a + bg.r * bg.a * (1 - fg.a)) / blended.a;
+		blended.g = (fg.g * fg.a + bg.g * bg.a * (1 - fg.a)) / blended.a;
+		blended.b = (fg.b * fg.a + bg.b * bg.a * (1 - fg.a)) / blended.a;
+	}
+	else {
+		blended.r = blended.g = blended.b = 0;  // Fully transparent
+	}
+	return blended;
+}
+
+// The separable modes: Mix(cb, cs) is the color a fully opaque source
+// cs gives over a fully opaque backdrop cb, one channel at a time.
+struct MultiplyMix {
+	static float Mix(float cb, float cs) { return cb * cs; }
+};
+struct ScreenMix {
+	static float Mix(float cb, float cs) { return cb + cs - cb * cs; }
+};
+struct OverlayMix {
+	static float Mix(float cb, float cs) {
+		return cb <= 0.5f ? 2 * cb * cs : 1 - 2 * (1 - cb) * (1 - cs);
+	}
+};
+struct AddMix {
+	static float Mix(float cb, float cs) { return std::min(cb + cs, 1.0f); }
+};
+struct DifferenceMix {
+	static float Mix(float cb, float cs) { return cb > cs ? cb - cs : cs - cb; }
+};
+
+// A kernel composites one source pixel onto one backdrop pixel.
+struct NormalKernel {
+	static pixel Blend(const pixel& fg, const pixel& bg) {
+		return BlendPixel(fg, bg);
+	}
+};
+
+// Where only the source covers, its color shows; where only the backdrop
+// does, its color; where both do, Mix of the two.
+template <class Mix>
+struct SeparableKernel {
+	static pixel Blend(const pixel& fg, const pixel& bg) {
+		float onlyFg = fg.a * (1 - bg.a);
+		float both = fg.a * bg.a;
+		float onlyBg = bg.a * (1 - fg.a);
+		pixel blended;
+		blended.a = fg.a + onlyBg;
+		if (blended.a > 0) {
+			blended.r = (onlyFg * fg.r + both * Mix::Mix(bg.r, fg.r) + onlyBg * bg.r) / blended.a;
+			blended.g = (onlyFg * fg.g + both * Mix::Mix(bg.g, fg.g) + onlyBg * bg.g) / blended.a;
+			blended.b = (onlyFg * fg.b + both * Mix::Mix(bg.b, fg.b) + onlyBg * bg.b) / blended.a;
+		}
+		else {
+			blended.r = blended.g = blended.b = 0;  // Fully transparent
+		}
+		return blended;
+	}
+};
+
+// The scanline driver every mode shares: the kernel is a template
+// argument, so it is inlined into the loop and a mode costs nothing per
+// pixel beyond its own arithmetic.
+template <class Kernel>
+void BlendScanline(const pixel* src, pixel* dst, int n) {
+	for (int j = 0; j < n; ++j) {
+		dst[j] = Kernel::Blend(src[j], dst[j]);
+	}
+}
+
+// Composites n src pixels onto n dst pixels, in place.
+typedef void (*ScanlineBlender)(const pixel* src, pixel* dst, int n);
+
+// The specialized driver for a mode; look it up once per layer.
+ScanlineBlender GetScanlineBlender(BlendMode mode);
+
+// 8-bit "over" for a layer with one opacity on every pixel. The weights
+// then depend only on the backdrop's alpha, so they are tabulated once
+// per layer and a pixel costs a lookup and an integer multiply-shift
+// per channel, with no divides.
+struct OpacityTables {
+	unsigned char alpha[256];   // result alpha, by backdrop alpha
+	unsigned short weight[256]; // source weight out of 256, by backdrop alpha
+};
+
+void MakeOpacityTables(unsigned char opacity, OpacityTables& tables);
+
+// Composites n src pixels, whose own alpha bytes are ignored, onto n dst
+// pixels in place.
+void BlendScanline8(const RGBApixel* src, RGBApixel* dst, int n, const OpacityTables& tables);
@@ -0,0 +1,118 @@
+#include "Blur.h"
+#include "EasyBMP_Parallel.h"
+#include "Simd.h"
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// Columns per band: below this a thread costs more than it saves.
+const int MIN_BAND = 16;
+
+// One step of the window across: sum += enter, out = sum * scale,
+// sum -= leave, for n values down a column.
+void Slide(float* sum, const float* enter, const float* leave, float* out, float scale, int n) {
+	int y = 0;
+#ifdef SIMD_SSE2
+	__m128 scale4 = _mm_set1_ps(scale);
+	for (; y + 4 <= n; y += 4) {
+		__m128 s = _mm_add_ps(_mm_loadu_ps(sum + y), _mm_loadu_ps(enter + y));
+		_mm_storeu_ps(out + y, _mm_mul_ps(s, scale4));
+		_mm_storeu_ps(sum + y, _mm_sub_ps(s, _mm_loadu_ps(leave + y)));
+	}
+#endif
+	for (; y < n; ++y) {
+		float s = sum[y] + enter[y];
+		out[y] = s * scale;
+		sum[y] = s - leave[y];
+	}
+}
+
+}
+
+void BoxFilterPadded(const Plane& in, Plane& out, int rx, int ry) {
+	out = Plane(in.w - 2 * rx, in.h - 2 * ry);
+	if (out.w <= 0 || out.h <= 0)
+		return;
+
+	// Across, the window slides over whole columns at once, which keeps the
+	// inner loop contiguous. Each band restarts its sum, so rounding can
+	// only build up over one band.
+	Plane across(out.w, in.h);
+	float scaleX = 1.0f / (2 * rx + 1);
+	EasyBMPparallelFor(0, out.w, 0, MIN_BAND, [&](int begin, int end) {
+		std::vector<float> sum(in.h, 0.0f);
+		for (int i = 0; i < 2 * rx; ++i) {
+			const float* column = in.Column(begin + i);
+			for (int y = 0; y < in.h; ++y) {
+				sum[y] += column[y];
+			}
+		}
+		for (int x = begin; x < end; ++x) {
+			Slide(sum.data(), in.Column(x + 2 * rx), in.Column(x), across.Column(x), scaleX, in.h);
+		}
+	});
+
+	// Down, each column has its own sum, kept in double.
+	double scaleY = 1.0 / (2 * ry + 1);
+	EasyBMPparallelFor(0, out.w, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			const float* column = across.Column(x);
+			float* result = out.Column(x);
+			double sum = 0;
+			for (int j = 0; j < 2 * ry; ++j) {
+				sum += column[j];
+			}
+			for (int y = 0; y < out.h; ++y) {
+				sum += column[y + 2 * ry];
+				result[y] = (float)(sum * scaleY);
+				sum -= column[y];
+			}
+		}
+	});
+}
+
+void GaussianBoxRadii(float sigma, int radii[3]) {
+	// Widths wl and wl + 2, both odd, with m of the three at wl: the choice
+	// whose variances add up closest to sigma squared.
+	const int n = 3;
+	double variance = (double)sigma * sigma;
+	int wl = (int)std::floor(std::sqrt(12 * variance / n + 1));
+	if (wl % 2 == 0)
+		--wl;
+	wl = std::max(wl, 1);
+	int m = (int)std::floor((12 * variance - n * wl * wl - 4 * n * wl - 3 * n) / (-4 * wl - 4) + 0.5);
+	for (int i = 0; i < n; ++i) {
+		int width = i < m ? wl : wl + 2;
+		radii[i] = (width - 1) / 2;
+	}
+}
+
+pixel** BoxBlurMap(pixel** map, int w, int h, Rect roi, int rx, int ry, Border border) {
+	std::vector<Plane> planes = ReadColorPlanes(map, w, h, roi, rx, ry, border);
+	for (Plane& plane : planes) {
+		Plane out;
+		BoxFilterPadded(plane, out, rx, ry);
+		plane = std::move(out);
+	}
+	return WriteColorPlanes(planes, map, roi);
+}
+
+pixel** GaussianBlurMap(pixel** map, int w, int h, Rect roi, float sigma, Border border) {
+	int radii[3];
+	GaussianBoxRadii(sigma, radii);
+	int reach = radii[0] + radii[1] + radii[2];
+
+	// the border is read once, as far as all three passes reach together
+	std::vector<Plane> planes = ReadColorPlanes(map, w, h, roi, reach, reach, border);
+	for (Plane& plane : planes) {
+		for (int pass = 0; pass < 3; ++pass) {
+			if (radii[pass] == 0)
+				continue;
+			Plane out;
+			BoxFilterPadded(plane, out, radii[pass], radii[pass]);
+			plane = std::move(out);
+		}
+	}
+	return WriteColorPlanes(planes, map, roi);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Convolve.h"
+
+// Blurs whose cost per pixel does not depend on the radius: a box filter
+// slides a running sum along each axis, adding the pixel that enters the
+// window and subtracting the one that leaves it, and a Gaussian is
+// approximated by three box filters in a row.
+
+// Mean over a (2 rx + 1) x (2 ry + 1) window of a plane that carries its
+// border: out is (in.w - 2 rx) x (in.h - 2 ry).
+void BoxFilterPadded(const Plane& in, Plane& out, int rx, int ry);
+
+// Radii of three box filters that together come closest to a Gaussian of
+// standard deviation sigma.
+void GaussianBoxRadii(float sigma, int radii[3]);
+
+// Blur the colors of region roi of a w x h map, reading past the edge of
+// the map as border says; alpha is copied. Return a new roi.w x roi.h map.
+pixel** BoxBlurMap(pixel** map, int w, int h, Rect roi, int rx, int ry, Border border);
+pixel** GaussianBlurMap(pixel** map, int w, int h, Rect roi, float sigma, Border border);
@@ -0,0 +1,227 @@
+#include "Canny.h"
+#include "EasyBMP_Parallel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int MIN_BAND = 32;
+
+// Hysteresis works on tiles this many columns wide, one at a time per
+// thread.
+const int TILE = 128;
+
+enum { NONE, WEAK, EDGE };
+
+// Reach of a sampled Gaussian: three standard deviations
+int GaussianRadius(float sigma) {
+	return std::max(1, (int)std::ceil(3 * sigma));
+}
+
+// The taps of a sampled Gaussian, normalised to sum to 1; the 2-D
+// kernel is taps[i] * taps[j].
+void GaussianTaps(float sigma, std::vector<float>& taps) {
+	int radius = GaussianRadius(sigma);
+	taps.resize(2 * radius + 1);
+	float total = 0;
+	for (int i = 0; i < (int)taps.size(); ++i) {
+		taps[i] = std::exp(-(float)((i - radius) * (i - radius)) / (2 * sigma * sigma));
+		total += taps[i];
+	}
+	for (float& tap : taps) {
+		tap /= total;
+	}
+}
+
+void Reshape(Plane& plane, int w, int h) {
+	plane.w = w;
+	plane.h = h;
+	plane.data.resize((size_t)w * h);
+}
+
+// Sobel gradients of smoothed, which has a 1-pixel border: the magnitude,
+// scaled by 1/4, and the direction across the edge, in steps of 45
+// degrees: 0 along x, 1 on the diagonal where x and y grow together, 2
+// along y, 3 on the other diagonal.
+void Gradients(const Plane& smoothed, Plane& magnitude, std::vector<unsigned char>& direction) {
+	int w = smoothed.w - 2, h = smoothed.h - 2;
+	Reshape(magnitude, w, h);
+	direction.resize((size_t)w * h);
+	const float tan22 = 0.41421356f, tan67 = 2.41421356f;
+	EasyBMPparallelFor(0, w, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			const float* left = smoothed.Column(x);
+			const float* middle = smoothed.Column(x + 1);
+			const float* right = smoothed.Column(x + 2);
+			float* m = magnitude.Column(x);
+			unsigned char* d = &direction[(size_t)x * h];
+			for (int y = 0; y < h; ++y) {
+				float gx = (right[y] + 2 * right[y + 1] + right[y + 2]) - (left[y] + 2 * left[y + 1] + left[y + 2]);
+				float gy = (left[y + 2] + 2 * middle[y + 2] + right[y + 2]) - (left[y] + 2 * middle[y] + right[y]);
+				m[y] = std::sqrt(gx * gx + gy * gy) / 4.0f;
+				float ax = std::fabs(gx), ay = std::fabs(gy);
+				if (ay <= ax * tan22)
+					d[y] = 0;
+				else if (ay >= ax * tan67)
+					d[y] = 2;
+				else
+					d[y] = (gx > 0) == (gy > 0) ? 1 : 3;
+			}
+		}
+	});
+}
+
+// Non-maximum suppression and the double threshold, over the magnitude
+// plane less its 1-pixel border: each pixel's state is NONE, WEAK or EDGE.
+void Suppress(const Plane& magnitude, const std::vector<unsigned char>& direction, float low, float high,
+	std::vector<unsigned char>& state) {
+	int w = magnitude.w - 2, h = magnitude.h - 2;
+	state.assign((size_t)w * h, NONE);
+	// the neighbours across the edge, as (dx, dy), for each direction
+	const int across[4][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { 1, -1 } };
+	EasyBMPparallelFor(0, w, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			const float* m = magnitude.Column(x + 1);
+			const unsigned char* d = &direction[(size_t)(x + 1) * magnitude.h];
+			unsigned char* s = &state[(size_t)x * h];
+			for (int y = 0; y < h; ++y) {
+				float value = m[y + 1];
+				if (value < low)
+					continue;
+				const int* step = across[d[y + 1]];
+				float ahead = magnitude.Column(x + 1 + step[0])[y + 1 + step[1]];
+				float behind = magnitude.Column(x + 1 - step[0])[y + 1 - step[1]];
+				// strictly above one side, so a plateau two pixels wide keeps one
+				if (value > ahead && value >= behind)
+					s[y] = value >= high ? EDGE : WEAK;
+			}
+		}
+	});
+}
+
+// Turns every WEAK pixel of [x0, x1) connected to a seed into an EDGE,
+// without leaving those columns.
+void Grow(std::vector<unsigned char>& state, int h, int x0, int x1, std::vector<int>& stack) {
+	while (!stack.empty()) {
+		int index = stack.back();
+		stack.pop_back();
+		int x = index / h, y = index % h;
+		for (int dx = -1; dx <= 1; ++dx) {
+			int nx = x + dx;
+			if (nx < x0 || nx >= x1)
+				continue;
+			for (int dy = -1; dy <= 1; ++dy) {
+				int ny = y + dy;
+				if (ny < 0 || ny >= h)
+					continue;
+				int neighbour = nx * h + ny;
+				if (state[neighbour] == WEAK) {
+					state[neighbour] = EDGE;
+					stack.push_back(neighbour);
+				}
+			}
+		}
+	}
+}
+
+// Hysteresis, tile-parallel: every tile grows its strong edges within its
+// own columns; then the WEAK pixels next to an EDGE across a tile boundary
+// are promoted, and the tiles they are in grow again from them, until
+// nothing crosses.
+void Hysteresis(std::vector<unsigned char>& state, int w, int h, std::vector<std::vector<int>>& seeds) {
+	int tiles = (w + TILE - 1) / TILE;
+	seeds.resize(tiles);
+	for (int t = 0; t < tiles; ++t) {
+		seeds[t].clear();
+		int x1 = std::min(w, (t + 1) * TILE);
+		for (int x = t * TILE; x < x1; ++x) {
+			for (int y = 0; y < h; ++y) {
+				if (state[(size_t)x * h + y] == EDGE)
+					seeds[t].push_back(x * h + y);
+			}
+		}
+	}
+
+	for (;;) {
+		EasyBMPparallelFor(0, tiles, 0, [&](int begin, int end) {
+			for (int t = begin; t < end; ++t) {
+				Grow(state, h, t * TILE, std::min(w, (t + 1) * TILE), seeds[t]);
+			}
+		});
+
+		bool crossed = false;
+		for (int t = 1; t < tiles; ++t) {
+			// columns b - 1 and b face each other across the boundary
+			int b = t * TILE;
+			for (int y = 0; y < h; ++y) {
+				for (int side = 0; side < 2; ++side) {
+					int x = side ? b : b - 1, other = side ? b - 1 : b;
+					if (state[(size_t)x * h + y] != WEAK)
+						continue;
+					for (int dy = -1; dy <= 1; ++dy) {
+						int ny = y + dy;
+						if (ny >= 0 && ny < h && state[(size_t)other * h + ny] == EDGE) {
+							state[(size_t)x * h + y] = EDGE;
+							seeds[side ? t : t - 1].push_back(x * h + y);
+							crossed = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+		if (!crossed)
+			return;
+	}
+}
+
+}
+
+const Mask& CannyMap(pixel** map, int w, int h, Rect roi, const CannySettings& settings, CannyWorkspace& workspace) {
+	if (workspace.sigma != settings.sigma) {
+		GaussianTaps(settings.sigma, workspace.gaussian);
+		workspace.sigma = settings.sigma;
+	}
+	// Gaussian, Sobel and suppression each take one more ring of pixels
+	int reach = GaussianRadius(settings.sigma) + 2;
+	int pw = roi.w + 2 * reach, ph = roi.h + 2 * reach;
+
+	workspace.intensity.resize(1);
+	Plane& intensity = workspace.intensity[0];
+	Reshape(intensity, pw, ph);
+	std::vector<int>& rows = workspace.rows;
+	rows.resize(ph);
+	for (int j = 0; j < ph; ++j) {
+		rows[j] = BorderIndex(roi.y - reach + j, h, Border::Clamp);
+	}
+	EasyBMPparallelFor(0, pw, 0, MIN_BAND, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			const pixel* column = map[BorderIndex(roi.x - reach + i, w, Border::Clamp)];
+			float* out = intensity.Column(i);
+			for (int j = 0; j < ph; ++j) {
+				const pixel& p = column[rows[j]];
+				out[j] = 0.299f * p.r + 0.587f * p.g + 0.114f * p.b;
+			}
+		}
+	});
+
+	ConvolveSeparablePadded(workspace.intensity, workspace.smoothed, workspace.gaussian, workspace.gaussian, workspace.across);
+	Gradients(workspace.smoothed[0], workspace.magnitude, workspace.direction);
+	Suppress(workspace.magnitude, workspace.direction, settings.low, settings.high, workspace.state);
+	Hysteresis(workspace.state, roi.w, roi.h, workspace.seeds);
+
+	Mask& edges = workspace.edges;
+	if (edges.w == roi.w && edges.h == roi.h)
+		std::fill(edges.bits.begin(), edges.bits.end(), 0);
+	else
+		edges = Mask(roi.w, roi.h);
+	for (int x = 0; x < roi.w; ++x) {
+		const unsigned char* s = &workspace.state[(size_t)x * roi.h];
+		uint64_t* bits = edges.Column(x);
+		for (int y = 0; y < roi.h; ++y) {
+			if (s[y] == EDGE)
+				bits[y >> 6] |= (uint64_t)1 << (y & 63);
+		}
+	}
+	return edges;
+}
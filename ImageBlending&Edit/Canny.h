@@ -0,0 +1,39 @@
+#pragma once
+#include "Convolve.h"
+#include "Mask.h"
+
+// Canny edge detection: the luminance is smoothed with a Gaussian, Sobel
+// gradients give each pixel a magnitude and one of four directions, a
+// pixel stays only where its magnitude is a maximum across the edge, and
+// of those the strong ones, and the weak ones joined to them through
+// other edge pixels, are the edges.
+struct CannySettings {
+	float sigma; // of the smoothing Gaussian
+	float low, high; // weak and strong thresholds, on the gradient magnitude / 4 as toSobelEdgeDetection shows it
+
+	CannySettings() : sigma(1.4f), low(0.05f), high(0.15f) {}
+};
+
+// Everything CannyMap works in, kept from call to call so that filtering
+// a region of the same size again with the same sigma, as the display
+// does every frame, allocates no buffers.
+struct CannyWorkspace {
+	float sigma; // that gaussian was built for; 0 until it is
+	std::vector<float> gaussian; // the 1-D taps, used both across and down
+	std::vector<Plane> intensity, smoothed; // one plane each, as ConvolveSeparablePadded takes them
+	Plane across; // the Gaussian's pass across
+	Plane magnitude;
+	std::vector<unsigned char> direction, state;
+	std::vector<int> rows; // the map row each intensity row is read from
+	std::vector<std::vector<int>> seeds; // per hysteresis tile
+	Mask edges;
+
+	CannyWorkspace() : sigma(0) {}
+};
+
+// The edges of region roi of a w x h map, as a roi.w x roi.h mask held in
+// the workspace until the next call. The stages before hysteresis read a
+// halo around roi, as far as they reach, with the map's edge pixels
+// repeated beyond it, so they match the whole map's; hysteresis follows
+// weak edges only within roi.
+const Mask& CannyMap(pixel** map, int w, int h, Rect roi, const CannySettings& settings, CannyWorkspace& workspace);
@@ -0,0 +1,165 @@
+#include "Components.h"
+#include "EasyBMP_Parallel.h"
+#include <algorithm>
+
+namespace {
+
+// Columns per tile: each tile's runs are labelled by one thread.
+const int TILE = 256;
+
+struct Run {
+	int x, top, bottom; // rows top .. bottom - 1 of column x
+};
+
+// Appends the runs of set pixels in column x of mask to runs.
+void FindRuns(const Mask& mask, int x, std::vector<Run>& runs) {
+	const uint64_t* column = mask.Column(x);
+	int top = -1; // of the run being followed, if any
+	for (int k = 0; k < mask.words; ++k) {
+		// outside a run look for the next set bit, inside one the next clear bit
+		int y = 0;
+		while (y < 64) {
+			uint64_t look = (top < 0 ? column[k] : ~column[k]) >> y;
+			if (look == 0)
+				break;
+			y += CountTrailingZeros64(look);
+			if (top < 0) {
+				top = k * 64 + y;
+			}
+			else {
+				runs.push_back(Run{ x, top, k * 64 + y });
+				top = -1;
+			}
+		}
+	}
+	if (top >= 0)
+		runs.push_back(Run{ x, top, mask.h });
+}
+
+int Find(std::vector<int>& parent, int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+// The root with the smaller index wins, so the result does not depend on
+// the order of the unions.
+void Union(std::vector<int>& parent, int a, int b) {
+	a = Find(parent, a);
+	b = Find(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+// Joins the runs of two neighbouring columns that touch: left holds
+// indices [l0, l1) of runs, right [r0, r1), each sorted by top.
+void JoinColumns(const std::vector<Run>& runs, std::vector<int>& parent, int l0, int l1, int r0, int r1, int reach) {
+	int i = l0, j = r0;
+	while (i < l1 && j < r1) {
+		if (runs[i].top < runs[j].bottom + reach && runs[j].top < runs[i].bottom + reach)
+			Union(parent, i, j);
+		// step past whichever run ends first
+		if (runs[i].bottom < runs[j].bottom)
+			++i;
+		else
+			++j;
+	}
+}
+
+}
+
+Labeling LabelComponents(const Mask& mask, Connectivity connectivity) {
+	Labeling labeling;
+	labeling.w = mask.w;
+	labeling.h = mask.h;
+	labeling.labels.assign((size_t)mask.w * mask.h, 0);
+	int reach = connectivity == Connectivity::Eight ? 1 : 0;
+	int tiles = (mask.w + TILE - 1) / TILE;
+
+	// the runs of each tile, then all of them in order with start[x] the
+	// index of column x's first run
+	std::vector<std::vector<Run>> tileRuns(tiles);
+	EasyBMPparallelFor(0, tiles, 0, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			for (int x = t * TILE; x < std::min(mask.w, (t + 1) * TILE); ++x) {
+				FindRuns(mask, x, tileRuns[t]);
+			}
+		}
+	});
+	std::vector<Run> runs;
+	for (const std::vector<Run>& own : tileRuns) {
+		runs.insert(runs.end(), own.begin(), own.end());
+	}
+	std::vector<int> start(mask.w + 1, 0);
+	for (const Run& run : runs) {
+		++start[run.x + 1];
+	}
+	for (int x = 0; x < mask.w; ++x) {
+		start[x + 1] += start[x];
+	}
+
+	// within each tile, on its own runs only...
+	std::vector<int> parent(runs.size());
+	for (size_t i = 0; i < runs.size(); ++i) {
+		parent[i] = (int)i;
+	}
+	EasyBMPparallelFor(0, tiles, 0, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			for (int x = t * TILE + 1; x < std::min(mask.w, (t + 1) * TILE); ++x) {
+				JoinColumns(runs, parent, start[x - 1], start[x], start[x], start[x + 1], reach);
+			}
+		}
+	});
+	// ...then across the tile boundaries
+	for (int t = 1; t < tiles; ++t) {
+		int x = t * TILE;
+		JoinColumns(runs, parent, start[x - 1], start[x], start[x], start[x + 1], reach);
+	}
+
+	// number the roots in order and add up each component from its runs
+	std::vector<int> label(runs.size());
+	std::vector<double> sumX, sumY;
+	for (size_t i = 0; i < runs.size(); ++i) {
+		int root = Find(parent, (int)i);
+		const Run& run = runs[i];
+		int length = run.bottom - run.top;
+		if (root == (int)i) {
+			label[i] = (int)labeling.components.size() + 1;
+			labeling.components.push_back(ComponentStats{ 0, Rect{ run.x, run.top, 1, length }, 0, 0 });
+			sumX.push_back(0);
+			sumY.push_back(0);
+		}
+		else {
+			label[i] = label[root];
+		}
+		int c = label[i] - 1;
+		ComponentStats& stats = labeling.components[c];
+		stats.area += length;
+		int right = std::max(stats.box.x + stats.box.w, run.x + 1);
+		int bottom = std::max(stats.box.y + stats.box.h, run.bottom);
+		stats.box.x = std::min(stats.box.x, run.x);
+		stats.box.y = std::min(stats.box.y, run.top);
+		stats.box.w = right - stats.box.x;
+		stats.box.h = bottom - stats.box.y;
+		sumX[c] += (double)run.x * length;
+		sumY[c] += (run.top + run.bottom - 1) * 0.5 * length;
+	}
+	for (size_t c = 0; c < labeling.components.size(); ++c) {
+		labeling.components[c].cx = sumX[c] / labeling.components[c].area;
+		labeling.components[c].cy = sumY[c] / labeling.components[c].area;
+	}
+
+	EasyBMPparallelFor(0, mask.w, 0, TILE, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			int* column = &labeling.labels[(size_t)x * mask.h];
+			for (int i = start[x]; i < start[x + 1]; ++i) {
+				std::fill(column + runs[i].top, column + runs[i].bottom, label[i]);
+			}
+		}
+	});
+	return labeling;
+}
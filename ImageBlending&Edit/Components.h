@@ -0,0 +1,35 @@
+#pragma once
+#include "Mask.h"
+#include <vector>
+
+enum class Connectivity {
+	Four, // pixels touching at a side are connected
+	Eight // and those touching at a corner
+};
+
+struct ComponentStats {
+	long long area; // pixels
+	Rect box; // the smallest rectangle holding the component
+	double cx, cy; // centroid
+};
+
+// The connected components of the set pixels of a mask. labels holds a
+// label per pixel, by column like the mask: 0 for clear pixels, else
+// 1 to components.size(), numbered in the order the components are first
+// met going down each column from the left. components[label - 1]
+// describes each.
+struct Labeling {
+	int w, h;
+	std::vector<int> labels;
+	std::vector<ComponentStats> components;
+
+	int At(int x, int y) const {
+		return labels[(size_t)x * h + y];
+	}
+};
+
+// Works on runs of set pixels down the columns, found a word at a time.
+// Tiles of columns are labelled in parallel, each with its own union-find
+// over its runs; the tiles are then joined along their boundaries, and
+// the label image and the statistics are filled in from the runs.
+Labeling LabelComponents(const Mask& mask, Connectivity connectivity);
@@ -0,0 +1,356 @@
+#include "Convolve.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iostream>
+
+Kernel::Kernel(int w, int h, const std::vector<float>& taps) : w(w), h(h), taps(taps) {
+	if (w <= 0 || h <= 0 || w % 2 == 0 || h % 2 == 0 || taps.size() != (size_t)w * h) {
+		std::cerr << "Kernel sizes must be odd and match the number of taps." << std::endl;
+		exit(1);
+	}
+}
+
+bool SeparateKernel(const Kernel& kernel, std::vector<float>& across, std::vector<float>& down) {
+	// factor through the largest tap, then check every tap against the product
+	int pi = 0, pj = 0;
+	float largest = 0;
+	for (int j = 0; j < kernel.h; ++j) {
+		for (int i = 0; i < kernel.w; ++i) {
+			if (std::fabs(kernel.At(i, j)) > largest) {
+				largest = std::fabs(kernel.At(i, j));
+				pi = i;
+				pj = j;
+			}
+		}
+	}
+	if (largest == 0)
+		return false;
+
+	std::vector<float> a(kernel.w), d(kernel.h);
+	for (int i = 0; i < kernel.w; ++i) {
+		a[i] = kernel.At(i, pj);
+	}
+	for (int j = 0; j < kernel.h; ++j) {
+		d[j] = kernel.At(pi, j) / kernel.At(pi, pj);
+	}
+	for (int j = 0; j < kernel.h; ++j) {
+		for (int i = 0; i < kernel.w; ++i) {
+			if (std::fabs(a[i] * d[j] - kernel.At(i, j)) > 1e-6f * largest)
+				return false;
+		}
+	}
+	across.swap(a);
+	down.swap(d);
+	return true;
+}
+
+namespace {
+
+// y[0..n) += a * x[0..n): every path below is built from this, running
+// down columns, which are contiguous.
+void Axpy(float a, const float* x, float* y, int n) {
+	int j = 0;
+#ifdef SIMD_SSE2
+	__m128 a4 = _mm_set1_ps(a);
+	for (; j + 4 <= n; j += 4) {
+		_mm_storeu_ps(y + j, _mm_add_ps(_mm_loadu_ps(y + j), _mm_mul_ps(a4, _mm_loadu_ps(x + j))));
+	}
+#endif
+	for (; j < n; ++j) {
+		y[j] += a * x[j];
+	}
+}
+
+// Makes plane w x h and all 0, reusing it when it already has that
+// size; the paths below add into their outputs.
+void ZeroPlane(Plane& plane, int w, int h) {
+	if (plane.w == w && plane.h == h)
+		std::fill(plane.data.begin(), plane.data.end(), 0.0f);
+	else
+		plane = Plane(w, h);
+}
+
+void ConvolveSeparable(const std::vector<Plane>& in, std::vector<Plane>& out,
+	const std::vector<float>& across, const std::vector<float>& down, Plane& scratch) {
+	for (size_t c = 0; c < in.size(); ++c) {
+		// across first, over the full padded height, then down
+		ZeroPlane(scratch, out[c].w, in[c].h);
+		for (int x = 0; x < out[c].w; ++x) {
+			for (size_t i = 0; i < across.size(); ++i) {
+				if (across[i] != 0)
+					Axpy(across[i], in[c].Column(x + (int)i), scratch.Column(x), in[c].h);
+			}
+		}
+		for (int x = 0; x < out[c].w; ++x) {
+			for (size_t j = 0; j < down.size(); ++j) {
+				if (down[j] != 0)
+					Axpy(down[j], scratch.Column(x) + j, out[c].Column(x), out[c].h);
+			}
+		}
+	}
+}
+
+void ConvolveDirect(const std::vector<Plane>& in, std::vector<Plane>& out, const Kernel& kernel) {
+	for (size_t c = 0; c < in.size(); ++c) {
+		for (int x = 0; x < out[c].w; ++x) {
+			for (int i = 0; i < kernel.w; ++i) {
+				for (int j = 0; j < kernel.h; ++j) {
+					float tap = kernel.At(i, j);
+					if (tap != 0)
+						Axpy(tap, in[c].Column(x + i) + j, out[c].Column(x), out[c].h);
+				}
+			}
+		}
+	}
+}
+
+typedef std::complex<float> Complex;
+
+int PowerOfTwoAtLeast(int n) {
+	int p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+// In-place radix-2 transform of n values, n a power of two; roots holds
+// exp(-2 pi i k / n) for k < n / 2.
+void FFT(Complex* a, int n, const std::vector<Complex>& roots, bool inverse) {
+	for (int i = 1, j = 0; i < n; ++i) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j)
+			std::swap(a[i], a[j]);
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		int step = n / len;
+		for (int start = 0; start < n; start += len) {
+			for (int k = 0; k < len / 2; ++k) {
+				// written out: operator* on std::complex also handles infinities
+				Complex w = roots[k * step];
+				float wi = inverse ? -w.imag() : w.imag();
+				Complex u = a[start + k], x = a[start + k + len / 2];
+				Complex v(x.real() * w.real() - x.imag() * wi, x.real() * wi + x.imag() * w.real());
+				a[start + k] = u + v;
+				a[start + k + len / 2] = u - v;
+			}
+		}
+	}
+}
+
+std::vector<Complex> Roots(int n) {
+	std::vector<Complex> roots(std::max(n / 2, 1));
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < n / 2; ++k) {
+		roots[k] = Complex((float)std::cos(-2 * pi * k / n), (float)std::sin(-2 * pi * k / n));
+	}
+	return roots;
+}
+
+// 2-D transform of a fw x fh array stored by column. Across, the same
+// butterflies run on whole columns at a time rather than on gathered
+// rows, so every pass streams through contiguous memory.
+void FFT2D(std::vector<Complex>& a, int fw, int fh, const std::vector<Complex>& rootsW,
+	const std::vector<Complex>& rootsH, bool inverse) {
+	for (int x = 0; x < fw; ++x) {
+		FFT(&a[(size_t)x * fh], fh, rootsH, inverse);
+	}
+	for (int i = 1, j = 0; i < fw; ++i) {
+		int bit = fw >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j)
+			std::swap_ranges(&a[(size_t)i * fh], &a[(size_t)i * fh] + fh, &a[(size_t)j * fh]);
+	}
+	for (int len = 2; len <= fw; len <<= 1) {
+		int step = fw / len;
+		for (int start = 0; start < fw; start += len) {
+			for (int k = 0; k < len / 2; ++k) {
+				Complex w = rootsW[k * step];
+				float wr = w.real(), wi = inverse ? -w.imag() : w.imag();
+				Complex* u = &a[(size_t)(start + k) * fh];
+				Complex* v = &a[(size_t)(start + k + len / 2) * fh];
+				for (int y = 0; y < fh; ++y) {
+					Complex x = v[y];
+					Complex t(x.real() * wr - x.imag() * wi, x.real() * wi + x.imag() * wr);
+					v[y] = u[y] - t;
+					u[y] += t;
+				}
+			}
+		}
+	}
+}
+
+// Correlation by the convolution theorem, two planes per transform: one
+// as the real part, the other as the imaginary part. The kernel is real,
+// so the two results come back apart in the same way.
+void ConvolveFFT(const std::vector<Plane>& in, std::vector<Plane>& out, const Kernel& kernel) {
+	int fw = PowerOfTwoAtLeast(in[0].w);
+	int fh = PowerOfTwoAtLeast(in[0].h);
+	std::vector<Complex> rootsW = Roots(fw), rootsH = Roots(fh);
+
+	std::vector<Complex> spectrum((size_t)fw * fh);
+	for (int i = 0; i < kernel.w; ++i) {
+		for (int j = 0; j < kernel.h; ++j) {
+			spectrum[(size_t)i * fh + j] = kernel.At(i, j);
+		}
+	}
+	FFT2D(spectrum, fw, fh, rootsW, rootsH, false);
+
+	float scale = 1.0f / ((float)fw * fh);
+	std::vector<Complex> a((size_t)fw * fh);
+	for (size_t c = 0; c < in.size(); c += 2) {
+		const Plane& first = in[c];
+		const Plane* second = c + 1 < in.size() ? &in[c + 1] : nullptr;
+		std::fill(a.begin(), a.end(), Complex(0, 0));
+		for (int x = 0; x < first.w; ++x) {
+			for (int y = 0; y < first.h; ++y) {
+				a[(size_t)x * fh + y] = Complex(first.Column(x)[y], second ? second->Column(x)[y] : 0.0f);
+			}
+		}
+		FFT2D(a, fw, fh, rootsW, rootsH, false);
+		for (size_t k = 0; k < a.size(); ++k) {
+			Complex x = a[k], f = spectrum[k];
+			a[k] = Complex(x.real() * f.real() + x.imag() * f.imag(), x.imag() * f.real() - x.real() * f.imag());
+		}
+		FFT2D(a, fw, fh, rootsW, rootsH, true);
+		for (int x = 0; x < out[c].w; ++x) {
+			for (int y = 0; y < out[c].h; ++y) {
+				Complex v = a[(size_t)x * fh + y] * scale;
+				out[c].Column(x)[y] = v.real();
+				if (second)
+					out[c + 1].Column(x)[y] = v.imag();
+			}
+		}
+	}
+}
+
+}
+
+int BorderIndex(int i, int n, Border border) {
+	if (i >= 0 && i < n)
+		return i;
+	switch (border) {
+	case Border::Mirror: {
+		if (n == 1)
+			return 0;
+		int period = 2 * n - 2;
+		i = ((i % period) + period) % period;
+		return i < n ? i : period - i;
+	}
+	case Border::Wrap:
+		return ((i % n) + n) % n;
+	default:
+		return std::min(std::max(i, 0), n - 1);
+	}
+}
+
+void ConvolvePadded(const std::vector<Plane>& in, std::vector<Plane>& out, const Kernel& kernel, ConvolvePath path) {
+	out.resize(in.size());
+	if (in.empty())
+		return;
+	int w = in[0].w - kernel.w + 1;
+	int h = in[0].h - kernel.h + 1;
+	for (Plane& plane : out) {
+		ZeroPlane(plane, w, h);
+	}
+	if (w <= 0 || h <= 0)
+		return;
+
+	std::vector<float> across, down;
+	bool separable = (path == ConvolvePath::Auto || path == ConvolvePath::Separable) &&
+		SeparateKernel(kernel, across, down);
+	if (path == ConvolvePath::Auto) {
+		if (separable)
+			path = ConvolvePath::Separable;
+		else
+			path = kernel.w * kernel.h < FFT_MIN_TAPS ? ConvolvePath::Direct : ConvolvePath::FFT;
+	}
+	if (path == ConvolvePath::Separable && !separable)
+		path = ConvolvePath::Direct;
+
+	if (path == ConvolvePath::Separable) {
+		Plane scratch;
+		ConvolveSeparable(in, out, across, down, scratch);
+	}
+	else if (path == ConvolvePath::FFT)
+		ConvolveFFT(in, out, kernel);
+	else
+		ConvolveDirect(in, out, kernel);
+}
+
+void ConvolveSeparablePadded(const std::vector<Plane>& in, std::vector<Plane>& out,
+	const std::vector<float>& across, const std::vector<float>& down, Plane& scratch) {
+	if (across.size() % 2 == 0 || down.size() % 2 == 0) {
+		std::cerr << "Kernel factors must have an odd number of taps." << std::endl;
+		exit(1);
+	}
+	out.resize(in.size());
+	if (in.empty())
+		return;
+	int w = in[0].w - (int)across.size() + 1;
+	int h = in[0].h - (int)down.size() + 1;
+	for (Plane& plane : out) {
+		ZeroPlane(plane, w, h);
+	}
+	if (w > 0 && h > 0)
+		ConvolveSeparable(in, out, across, down, scratch);
+}
+
+std::vector<Plane> ReadColorPlanes(pixel** map, int w, int h, Rect roi, int padX, int padY, Border border) {
+	int pw = roi.w + 2 * padX;
+	int ph = roi.h + 2 * padY;
+	std::vector<int> rows(ph);
+	for (int j = 0; j < ph; ++j) {
+		rows[j] = BorderIndex(roi.y - padY + j, h, border);
+	}
+
+	// the border is made up here, once, so the passes need no bounds tests
+	std::vector<Plane> planes(3, Plane(pw, ph));
+	for (int i = 0; i < pw; ++i) {
+		const pixel* column = map[BorderIndex(roi.x - padX + i, w, border)];
+		float* r = planes[0].Column(i);
+		float* g = planes[1].Column(i);
+		float* b = planes[2].Column(i);
+		for (int j = 0; j < ph; ++j) {
+			const pixel& p = column[rows[j]];
+			r[j] = p.r;
+			g[j] = p.g;
+			b[j] = p.b;
+		}
+	}
+	return planes;
+}
+
+pixel** WriteColorPlanes(const std::vector<Plane>& planes, pixel** map, Rect roi) {
+	pixel** result = AllocPixelMap(roi.w, roi.h);
+	for (int x = 0; x < roi.w; ++x) {
+		const pixel* src = map[roi.x + x] + roi.y;
+		const float* r = planes[0].Column(x);
+		const float* g = planes[1].Column(x);
+		const float* b = planes[2].Column(x);
+		for (int y = 0; y < roi.h; ++y) {
+			result[x][y].r = r[y];
+			result[x][y].g = g[y];
+			result[x][y].b = b[y];
+			result[x][y].a = src[y].a;
+		}
+	}
+	return result;
+}
+
+pixel** ConvolveMap(pixel** map, int w, int h, Rect roi, const Kernel& kernel, Border border, ConvolvePath path) {
+	std::vector<Plane> in = ReadColorPlanes(map, w, h, roi, kernel.w / 2, kernel.h / 2, border);
+	std::vector<Plane> out;
+	ConvolvePadded(in, out, kernel, path);
+	return WriteColorPlanes(out, map, roi);
+}
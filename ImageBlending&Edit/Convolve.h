@@ -0,0 +1,83 @@
+#pragma once
+#include "Pixel.h"
+#include <vector>
+
+// How the pixels beyond the edge of an image are made up.
+enum class Border {
+	Clamp,  // repeat the edge pixel: aaa|abc
+	Mirror, // reflect about the edge pixel: cb|abc
+	Wrap    // tile the image: bc|abc
+};
+
+// Where coordinate i, in an image n wide, is read from.
+int BorderIndex(int i, int n, Border border);
+
+// A w x h kernel, both odd, with the taps given row by row. It is applied
+// as written (not flipped), centred on the output pixel:
+//
+//	out(x, y) = sum over i, j of At(i, j) * in(x + i - w/2, y + j - h/2)
+struct Kernel {
+	int w, h;
+	std::vector<float> taps;
+
+	Kernel(int w, int h, const std::vector<float>& taps);
+	float At(int i, int j) const {
+		return taps[(size_t)j * w + i];
+	}
+};
+
+// One channel of an image, stored by column like a pixel map.
+struct Plane {
+	int w, h;
+	std::vector<float> data;
+
+	Plane() : w(0), h(0) {}
+	Plane(int w, int h) : w(w), h(h), data((size_t)w * h) {}
+	float* Column(int x) {
+		return data.data() + (size_t)x * h;
+	}
+	const float* Column(int x) const {
+		return data.data() + (size_t)x * h;
+	}
+};
+
+// True if the kernel is rank one, At(i, j) == across[i] * down[j] to
+// within rounding, in which case the factors are filled in.
+bool SeparateKernel(const Kernel& kernel, std::vector<float>& across, std::vector<float>& down);
+
+// How a convolution is computed. Auto takes two 1-D passes when the
+// kernel separates; otherwise it sums the taps directly for kernels of
+// up to FFT_MIN_TAPS taps and multiplies spectra for larger ones.
+enum class ConvolvePath { Auto, Separable, Direct, FFT };
+
+// About where the transforms start to pay, at 23 x 23, on a
+// screen-sized image.
+const int FFT_MIN_TAPS = 529;
+
+// Convolves planes that already carry their border: each input is
+// (w + kernel.w - 1) x (h + kernel.h - 1) and yields a w x h output.
+// Planes already in out are reused when they have the right size.
+void ConvolvePadded(const std::vector<Plane>& in, std::vector<Plane>& out, const Kernel& kernel,
+	ConvolvePath path = ConvolvePath::Auto);
+
+// ConvolvePadded for the kernel across[i] * down[j], given as its factors
+// so that nothing has to separate it; both lengths must be odd. scratch
+// holds the pass across and, like the planes in out, is reused when it
+// has the right size.
+void ConvolveSeparablePadded(const std::vector<Plane>& in, std::vector<Plane>& out,
+	const std::vector<float>& across, const std::vector<float>& down, Plane& scratch);
+
+// The r, g and b planes of region roi of a w x h map, with padX columns
+// and padY rows more on each side, read past the map's edge as border
+// says.
+std::vector<Plane> ReadColorPlanes(pixel** map, int w, int h, Rect roi, int padX, int padY, Border border);
+
+// A new roi.w x roi.h map with its colors from the three planes and its
+// alpha from region roi of map.
+pixel** WriteColorPlanes(const std::vector<Plane>& planes, pixel** map, Rect roi);
+
+// Convolves the colors of region roi of a w x h map, reading past the
+// region as far as the kernel reaches and past the map's edge as border
+// says; alpha is copied. Returns a new roi.w x roi.h map.
+pixel** ConvolveMap(pixel** map, int w, int h, Rect roi, const Kernel& kernel, Border border,
+	ConvolvePath path = ConvolvePath::Auto);
@@ -19,6 +19,10 @@
 *************************************************/
 
 #include "EasyBMP.h"
+#include "EasyBMP_Parallel.h"
+
+#include <algorithm>
+#include <atomic>
 
 /* These functions are defined in EasyBMP.h */
 
@@ -31,6 +35,13 @@ void SetEasyBMPwarningsOn( void )
 bool GetEasyBMPwarningState( void )
 { return EasyBMPwarnings; }
 
+int EasyBMPthreads = 0;
+
+void SetEasyBMPthreads( int NumberOfThreads )
+{ EasyBMPthreads = NumberOfThreads; }
+int GetEasyBMPthreads( void )
+{ return EasyBMPthreads; }
+
 /* These functions are defined in EasyBMP_DataStructures.h */
 
 int IntPow( int base, int exponent )
@@ -140,6 +151,12 @@ bool BMP::SetPixel( int i, int j, RGBApixel NewPixel )
  return true;
 }
 
+RGBApixel* BMP::Column( int i )
+{ return Pixels[i]; }
+
+const RGBApixel* BMP::Column( int i ) const
+{ return Pixels[i]; }
+
 
 bool BMP::SetColor( int ColorNumber , RGBApixel NewColor )
 {
@@ -177,8 +194,7 @@ bool BMP::SetColor( int ColorNumber , RGBApixel NewColor )
  return true;
 }
 
-// RGBApixel BMP::GetColor( int ColorNumber ) const
-RGBApixel BMP::GetColor( int ColorNumber )
+RGBApixel BMP::GetColor( int ColorNumber ) const
 { 
  RGBApixel Output;
  Output.Red   = 255;
@@ -236,6 +252,11 @@ BMP::BMP()
  SizeOfMetaData1 = 0;
  MetaData2 = NULL;
  SizeOfMetaData2 = 0;
+
+ ColorLookupKeys = NULL;
+ ColorLookupValues = NULL;
+ DecodeTable = NULL;
+ Compression = 0;
 }
 
 // BMP::BMP( const BMP& Input )
@@ -257,6 +278,11 @@ BMP::BMP( BMP& Input )
  MetaData2 = NULL;
  SizeOfMetaData2 = 0;
 
+ ColorLookupKeys = NULL;
+ ColorLookupValues = NULL;
+ DecodeTable = NULL;
+ Compression = 0;
+
  // now, set the correct bit depth
  
  SetBitDepth( Input.TellBitDepth() );
@@ -290,6 +316,8 @@ BMP::BMP( BMP& Input )
 //   Pixels[i][j] = Input.GetPixel(i,j); // *Input(i,j);
   }
  }
+
+ Compression = Input.TellCompression();
 }
 
 BMP::~BMP()
@@ -305,6 +333,8 @@ BMP::~BMP()
  { delete [] MetaData1; }
  if( MetaData2 )
  { delete [] MetaData2; }
+ EndColorLookup();
+ FreeDecodeTable();
 } 
 
 RGBApixel* BMP::operator()(int i, int j)
@@ -328,20 +358,16 @@ RGBApixel* BMP::operator()(int i, int j)
  return &(Pixels[i][j]);
 }
 
-// int BMP::TellBitDepth( void ) const
-int BMP::TellBitDepth( void )
+int BMP::TellBitDepth( void ) const
 { return BitDepth; }
 
-// int BMP::TellHeight( void ) const
-int BMP::TellHeight( void )
+int BMP::TellHeight( void ) const
 { return Height; }
 
-// int BMP::TellWidth( void ) const
-int BMP::TellWidth( void )
+int BMP::TellWidth( void ) const
 { return Width; }
 
-// int BMP::TellNumberOfColors( void ) const
-int BMP::TellNumberOfColors( void )
+int BMP::TellNumberOfColors( void ) const
 {
  int output = IntPow( 2, BitDepth );
  if( BitDepth == 32 )
@@ -349,6 +375,30 @@ int BMP::TellNumberOfColors( void )
  return output;
 }
 
+int BMP::TellCompression( void ) const
+{ return Compression; }
+
+bool BMP::SetCompression( int NewCompression )
+{
+ using namespace std;
+ if( NewCompression != 0 && 
+     !( NewCompression == 1 && BitDepth == 8 ) && 
+     !( NewCompression == 2 && BitDepth == 4 ) )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Warning: Compression " << NewCompression 
+        << " is not supported at bit depth " << BitDepth << "." << endl
+        << "                 Use 1 (RLE8) with 8-bit or 2 (RLE4) with 4-bit images." << endl
+        << "                 Compression remains unchanged at " 
+        << Compression << "." << endl;
+  }
+  return false;
+ }
+ Compression = NewCompression;
+ return true;
+}
+
 bool BMP::SetBitDepth( int NewDepth )
 {
  using namespace std;
@@ -367,6 +417,8 @@ bool BMP::SetBitDepth( int NewDepth )
  }
  
  BitDepth = NewDepth;
+ if( ( Compression == 1 && BitDepth != 8 ) || ( Compression == 2 && BitDepth != 4 ) )
+ { Compression = 0; }
  if( Colors )
  { delete [] Colors; }
  int NumberOfColors = IntPow( 2, BitDepth );
@@ -473,7 +525,7 @@ bool BMP::WriteToFile( const char* FileName )
  
  double dTotalFileSize = 14 + 40 + dPaletteSize + dTotalPixelBytes;
  
- // write the file header 
+ // fill in the file header 
  
  BMFH bmfh;
  bmfh.bfSize = (ebmpDWORD) dTotalFileSize; 
@@ -481,16 +533,7 @@ bool BMP::WriteToFile( const char* FileName )
  bmfh.bfReserved2 = 0; 
  bmfh.bfOffBits = (ebmpDWORD) (14+40+dPaletteSize);  
  
- if( IsBigEndian() )
- { bmfh.SwitchEndianess(); }
- 
- fwrite( (char*) &(bmfh.bfType) , sizeof(ebmpWORD) , 1 , fp );
- fwrite( (char*) &(bmfh.bfSize) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmfh.bfReserved1) , sizeof(ebmpWORD) , 1 , fp );
- fwrite( (char*) &(bmfh.bfReserved2) , sizeof(ebmpWORD) , 1 , fp );
- fwrite( (char*) &(bmfh.bfOffBits) , sizeof(ebmpDWORD) , 1 , fp );
- 
- // write the info header 
+ // fill in the info header 
  
  BMIH bmih;
  bmih.biSize = 40;
@@ -515,21 +558,14 @@ bool BMP::WriteToFile( const char* FileName )
  // indicates that we'll be using bit fields for 16-bit files
  if( BitDepth == 16 )
  { bmih.biCompression = 3; }
+
+ // RLE output; the sizes are patched once the data has been written
+ bool IsRLE = ( Compression == 1 && BitDepth == 8 ) || 
+              ( Compression == 2 && BitDepth == 4 );
+ if( IsRLE )
+ { bmih.biCompression = Compression; }
  
- if( IsBigEndian() )
- { bmih.SwitchEndianess(); }
- 
- fwrite( (char*) &(bmih.biSize) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biWidth) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biHeight) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biPlanes) , sizeof(ebmpWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biBitCount) , sizeof(ebmpWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biCompression) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biSizeImage) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biXPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp );
- fwrite( (char*) &(bmih.biYPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp ); 
- fwrite( (char*) &(bmih.biClrUsed) , sizeof(ebmpDWORD) , 1 , fp);
- fwrite( (char*) &(bmih.biClrImportant) , sizeof(ebmpDWORD) , 1 , fp);
+ WriteBMPHeaders( fp, bmfh, bmih );
  
  // write the palette 
  if( BitDepth == 1 || BitDepth == 4 || BitDepth == 8 )
@@ -551,7 +587,34 @@ bool BMP::WriteToFile( const char* FileName )
  
  // write the pixels 
  int i,j;
- if( BitDepth != 16 )
+ if( BitDepth == 1 || BitDepth == 4 || BitDepth == 8 )
+ { BeginColorLookup(); }
+ if( IsRLE )
+ {
+  int DataSize = WriteRLEData( fp );
+  if( DataSize < 0 )
+  {
+   if( EasyBMPwarnings )
+   {
+    cout << "EasyBMP Error: Could not write proper amount of data." << endl;
+   }
+  }
+  else
+  {
+   // go back and fill in the real data and file sizes
+   ebmpDWORD TempDWORD = (ebmpDWORD) DataSize;
+   if( IsBigEndian() )
+   { TempDWORD = FlipDWORD( TempDWORD ); }
+   fseek( fp, 14+20, SEEK_SET );
+   fwrite( (char*) &TempDWORD , sizeof(ebmpDWORD) , 1 , fp );
+   TempDWORD = (ebmpDWORD) ( 14 + 40 + dPaletteSize + DataSize );
+   if( IsBigEndian() )
+   { TempDWORD = FlipDWORD( TempDWORD ); }
+   fseek( fp, 2, SEEK_SET );
+   fwrite( (char*) &TempDWORD , sizeof(ebmpDWORD) , 1 , fp );
+  }
+ }
+ else if( BitDepth != 16 )
  {  
   ebmpBYTE* Buffer;
   int BufferSize = (int) ( (Width*BitDepth)/8.0 );
@@ -598,6 +661,7 @@ bool BMP::WriteToFile( const char* FileName )
   
   delete [] Buffer;
  }
+ EndColorLookup();
  
  if( BitDepth == 16 )
  {
@@ -665,6 +729,88 @@ bool BMP::WriteToFile( const char* FileName )
  return true;
 }
 
+// The format checks shared by ReadFromFile and ReadFromMemory. 
+// Prints the usual error and returns false if EasyBMP can't decode 
+// an image with this info header. 
+
+static bool EasyBMPcheckHeaders( const BMIH& bmih, const char* FileName )
+{
+ using namespace std;
+ // if bmih.biCompression 1 or 2, then the file is RLE compressed:
+ // 1 (RLE8) is only defined for 8-bit files, 2 (RLE4) for 4-bit files
+ 
+ if( ( bmih.biCompression == 1 && bmih.biBitCount != 8 ) || 
+     ( bmih.biCompression == 2 && bmih.biBitCount != 4 ) )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName << " is (RLE) compressed at a" << endl
+        << "               bit depth that does not allow it." << endl;
+  }
+  return false; 
+ }
+ 
+ // if bmih.biCompression > 3, then something strange is going on 
+ // it's probably an OS2 bitmap file.
+ 
+ if( bmih.biCompression > 3 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName << " is in an unsupported format." 
+        << endl
+        << "               (bmih.biCompression = " 
+	    << bmih.biCompression << ")" << endl
+	    << "               The file is probably an old OS2 bitmap or corrupted." 
+	    << endl;
+  }		
+  return false; 
+ }
+ 
+ if( bmih.biCompression == 3 && bmih.biBitCount != 16 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName 
+        << " uses bit fields and is not a" << endl
+        << "               16-bit file. This is not supported." << endl;
+  }
+  return false; 
+ }
+
+ // check the bit depth
+ 
+ int TempBitDepth = (int) bmih.biBitCount;
+ if(    TempBitDepth != 1  && TempBitDepth != 4 
+     && TempBitDepth != 8  && TempBitDepth != 16
+     && TempBitDepth != 24 && TempBitDepth != 32 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName << " has unrecognized bit depth." << endl;
+  }
+  return false;
+ }
+
+ // check the size; a negative height marks a top-down file, 
+ // which the format only allows for uncompressed data
+
+ bool IsRLE = ( bmih.biCompression == 1 || bmih.biCompression == 2 );
+ bool TopDown = ( (int) bmih.biHeight < 0 );
+ int TempHeight = TopDown ? -(int) bmih.biHeight : (int) bmih.biHeight;
+ if( (int) bmih.biWidth <= 0 || TempHeight <= 0 || ( TopDown && IsRLE ) ) 
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName 
+        << " has a non-positive width or height." << endl;
+  }
+  return false;
+ } 
+
+ return true;
+}
+
 bool BMP::ReadFromFile( const char* FileName )
 { 
  using namespace std;
@@ -766,88 +912,18 @@ bool BMP::ReadFromFile( const char* FileName )
  XPelsPerMeter = bmih.biXPelsPerMeter;
  YPelsPerMeter = bmih.biYPelsPerMeter;
  
- // if bmih.biCompression 1 or 2, then the file is RLE compressed
- 
- if( bmih.biCompression == 1 || bmih.biCompression == 2 )
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: " << FileName << " is (RLE) compressed." << endl
-        << "               EasyBMP does not support compression." << endl;
-  }
-  SetSize(1,1);
-  SetBitDepth(1);
-  fclose(fp);
-  return false; 
- }
- 
- // if bmih.biCompression > 3, then something strange is going on 
- // it's probably an OS2 bitmap file.
- 
- if( bmih.biCompression > 3 )
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: " << FileName << " is in an unsupported format." 
-        << endl
-        << "               (bmih.biCompression = " 
-	    << bmih.biCompression << ")" << endl
-	    << "               The file is probably an old OS2 bitmap or corrupted." 
-	    << endl;
-  }		
-  SetSize(1,1);
-  SetBitDepth(1);
-  fclose(fp);
-  return false; 
- }
- 
- if( bmih.biCompression == 3 && bmih.biBitCount != 16 )
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: " << FileName 
-        << " uses bit fields and is not a" << endl
-        << "               16-bit file. This is not supported." << endl;
-  }
-  SetSize(1,1);
-  SetBitDepth(1);
-  fclose(fp);
-  return false; 
- }
-
- // set the bit depth
- 
- int TempBitDepth = (int) bmih.biBitCount;
- if(    TempBitDepth != 1  && TempBitDepth != 4 
-     && TempBitDepth != 8  && TempBitDepth != 16
-     && TempBitDepth != 24 && TempBitDepth != 32 )
+ if( !EasyBMPcheckHeaders( bmih, FileName ) )
  {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: " << FileName << " has unrecognized bit depth." << endl;
-  }
   SetSize(1,1);
   SetBitDepth(1);
   fclose(fp);
   return false;
  }
- SetBitDepth( (int) bmih.biBitCount ); 
- 
- // set the size
 
- if( (int) bmih.biWidth <= 0 || (int) bmih.biHeight <= 0 ) 
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: " << FileName 
-        << " has a non-positive width or height." << endl;
-  }
-  SetSize(1,1);
-  SetBitDepth(1);
-  fclose(fp);
-  return false;
- } 
- SetSize( (int) bmih.biWidth , (int) bmih.biHeight );
+ bool IsRLE = ( bmih.biCompression == 1 || bmih.biCompression == 2 );
+ bool TopDown = ( (int) bmih.biHeight < 0 );
+ SetBitDepth( (int) bmih.biBitCount ); 
+ SetSize( (int) bmih.biWidth , TopDown ? -(int) bmih.biHeight : (int) bmih.biHeight );
   
  // some preliminaries
  
@@ -920,63 +996,23 @@ bool BMP::ReadFromFile( const char* FileName )
   delete [] TempSkipBYTE;
  } 
   
- // This code reads 1, 4, 8, 24, and 32-bpp files 
- // with a more-efficient buffered technique.
+ // RLE data is decoded as a stream, one row at a time 
 
- int i,j;
- if( BitDepth != 16 )
+ Compression = 0;
+ if( IsRLE )
  {
-  int BufferSize = (int) ( (Width*BitDepth) / 8.0 );
-  while( 8*BufferSize < Width*BitDepth )
-  { BufferSize++; }
-  while( BufferSize % 4 )
-  { BufferSize++; }
-  ebmpBYTE* Buffer;
-  Buffer = new ebmpBYTE [BufferSize];
-  j= Height-1;
-  while( j > -1 )
+  Compression = (int) bmih.biCompression;
+  if( !ReadRLEData( fp ) )
   {
-   int BytesRead = (int) fread( (char*) Buffer, 1, BufferSize, fp );
-   if( BytesRead < BufferSize )
+   if( EasyBMPwarnings )
    {
-    j = -1; 
-    if( EasyBMPwarnings )
-    {
-     cout << "EasyBMP Error: Could not read proper amount of data." << endl;
-	}
+    cout << "EasyBMP Error: Could not read proper amount of data." << endl;
    }
-   else
-   {
-    bool Success = false;
-    if( BitDepth == 1  )
-	{ Success = Read1bitRow(  Buffer, BufferSize, j ); }
-    if( BitDepth == 4  )
-	{ Success = Read4bitRow(  Buffer, BufferSize, j ); }
-    if( BitDepth == 8  )
-	{ Success = Read8bitRow(  Buffer, BufferSize, j ); }
-    if( BitDepth == 24 )
-	{ Success = Read24bitRow( Buffer, BufferSize, j ); }
-	if( BitDepth == 32 )
-	{ Success = Read32bitRow( Buffer, BufferSize, j ); }
-    if( !Success )
-    {
-     if( EasyBMPwarnings )
-     {
-      cout << "EasyBMP Error: Could not read enough pixel data!" << endl;
-	 }
-	 j = -1;
-    }
-   }   
-   j--;
   }
-  delete [] Buffer; 
  }
-
+  
  if( BitDepth == 16 )
  {
-  int DataBytes = Width*2;
-  int PaddingBytes = ( 4 - DataBytes % 4 ) % 4;
-
   // set the default mask
   
   ebmpWORD BlueMask = 31; // bits 12-16
@@ -1025,58 +1061,30 @@ bool BMP::ReadFromFile( const char* FileName )
    delete [] TempSkipBYTE;   
   } 
   
-  // determine the red, green and blue shifts
-  
-  int GreenShift = 0; 
-  ebmpWORD TempShiftWORD = GreenMask;
-  while( TempShiftWORD > 31 )
-  { TempShiftWORD = TempShiftWORD>>1; GreenShift++; }  
-  int BlueShift = 0;
-  TempShiftWORD = BlueMask;
-  while( TempShiftWORD > 31 )
-  { TempShiftWORD = TempShiftWORD>>1; BlueShift++; }  
-  int RedShift = 0;  
-  TempShiftWORD = RedMask;
-  while( TempShiftWORD > 31 )
-  { TempShiftWORD = TempShiftWORD>>1; RedShift++; }  
-  
-  // read the actual pixels
-  
-  for( j=Height-1 ; j >= 0 ; j-- )
+  SetDecodeMasks( RedMask, GreenMask, BlueMask );
+ }
+
+ // 1, 4, 8, 16, 24 and 32-bpp rows all share the same padded layout,
+ // so the uncompressed pixels are read with one buffered technique
+ 
+ if( !IsRLE )
+ {
+  int BufferSize = (int) ( (Width*BitDepth) / 8.0 );
+  while( 8*BufferSize < Width*BitDepth )
+  { BufferSize++; }
+  while( BufferSize % 4 )
+  { BufferSize++; }
+  long long Offset = (long long) ftell( fp );
+
+  BuildDecodeTable();
+  if( !ReadRows( fp, FileName, Offset, BufferSize, TopDown ) )
   {
-   i=0;
-   int ReadNumber = 0;
-   while( ReadNumber < DataBytes )
-   {
-	ebmpWORD TempWORD;
-	SafeFread( (char*) &TempWORD , 2 , 1 , fp );
-	if( IsBigEndian() )
-	{ TempWORD = FlipWORD(TempWORD); }
-    ReadNumber += 2;
-  
-    ebmpWORD Red = RedMask & TempWORD;
-    ebmpWORD Green = GreenMask & TempWORD;
-    ebmpWORD Blue = BlueMask & TempWORD;
-				
-	ebmpBYTE BlueBYTE = (ebmpBYTE) 8*(Blue>>BlueShift);
-    ebmpBYTE GreenBYTE = (ebmpBYTE) 8*(Green>>GreenShift);
-    ebmpBYTE RedBYTE = (ebmpBYTE) 8*(Red>>RedShift);
-		
-	(Pixels[i][j]).Red = RedBYTE;
-	(Pixels[i][j]).Green = GreenBYTE;
-	(Pixels[i][j]).Blue = BlueBYTE;
-	
-	i++;
-   }
-   ReadNumber = 0;
-   while( ReadNumber < PaddingBytes )
+   if( EasyBMPwarnings )
    {
-    ebmpBYTE TempBYTE;
-    SafeFread( (char*) &TempBYTE , 1, 1, fp);
-    ReadNumber++;
+    cout << "EasyBMP Error: Could not read proper amount of data." << endl;
    }
   }
-
+  FreeDecodeTable();
  }
  
  fclose(fp);
@@ -1291,11 +1299,84 @@ int BMP::TellHorizontalDPI( void )
 
 /* These functions are defined in EasyBMP_VariousBMPutilities.h */
 
-BMFH GetBMFH( const char* szFileNameIn )
+// Both headers together are the first 54 bytes of the file. They are
+// stored little-endian and unaligned, so they are assembled byte by
+// byte, which also makes the result independent of the host.
+
+static ebmpWORD HeaderWORD( const ebmpBYTE* Data )
+{ return (ebmpWORD) ( Data[0] | ( Data[1] << 8 ) ); }
+
+static ebmpDWORD HeaderDWORD( const ebmpBYTE* Data )
 {
- using namespace std;
- BMFH bmfh;
+ return (ebmpDWORD) Data[0] | ( (ebmpDWORD) Data[1] << 8 ) 
+      | ( (ebmpDWORD) Data[2] << 16 ) | ( (ebmpDWORD) Data[3] << 24 );
+}
+
+bool ParseBMPHeaders( const ebmpBYTE* Data, int Size, BMFH& bmfh, BMIH& bmih )
+{
+ if( Size < 14 )
+ { return false; }
+ bmfh.bfType = HeaderWORD( Data );
+ bmfh.bfSize = HeaderDWORD( Data+2 );
+ bmfh.bfReserved1 = HeaderWORD( Data+6 );
+ bmfh.bfReserved2 = HeaderWORD( Data+8 );
+ bmfh.bfOffBits = HeaderDWORD( Data+10 );
+
+ if( Size < 54 )
+ { return false; }
+ Data += 14;
+ bmih.biSize = HeaderDWORD( Data );
+ bmih.biWidth = HeaderDWORD( Data+4 );
+ bmih.biHeight = HeaderDWORD( Data+8 );
+ bmih.biPlanes = HeaderWORD( Data+12 );
+ bmih.biBitCount = HeaderWORD( Data+14 );
+ bmih.biCompression = HeaderDWORD( Data+16 );
+ bmih.biSizeImage = HeaderDWORD( Data+20 );
+ bmih.biXPelsPerMeter = HeaderDWORD( Data+24 );
+ bmih.biYPelsPerMeter = HeaderDWORD( Data+28 );
+ bmih.biClrUsed = HeaderDWORD( Data+32 );
+ bmih.biClrImportant = HeaderDWORD( Data+36 );
+ return true;
+}
+
+// the inverse of ParseBMPHeaders: writes both headers, little-endian,
+// at the current position of fp; returns false on a short write
+
+bool WriteBMPHeaders( FILE* fp, BMFH bmfh, BMIH bmih )
+{
+ if( IsBigEndian() )
+ {
+  bmfh.SwitchEndianess();
+  bmih.SwitchEndianess();
+ }
+ size_t Written = 0;
+ Written += fwrite( (char*) &(bmfh.bfType) , sizeof(ebmpWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmfh.bfSize) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmfh.bfReserved1) , sizeof(ebmpWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmfh.bfReserved2) , sizeof(ebmpWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmfh.bfOffBits) , sizeof(ebmpDWORD) , 1 , fp );
+
+ Written += fwrite( (char*) &(bmih.biSize) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biWidth) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biHeight) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biPlanes) , sizeof(ebmpWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biBitCount) , sizeof(ebmpWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biCompression) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biSizeImage) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biXPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp );
+ Written += fwrite( (char*) &(bmih.biYPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp ); 
+ Written += fwrite( (char*) &(bmih.biClrUsed) , sizeof(ebmpDWORD) , 1 , fp);
+ Written += fwrite( (char*) &(bmih.biClrImportant) , sizeof(ebmpDWORD) , 1 , fp);
+ return Written == 16;
+}
+
+// opens the file once and reads both headers with a single read;
+// returns false (after the usual warning) if the file can't be opened,
+// and false if it is too short to hold both headers
 
+static bool ReadBMPHeaders( const char* szFileNameIn, BMFH& bmfh, BMIH& bmih )
+{
+ using namespace std;
  FILE* fp;
  fp = fopen( szFileNameIn,"rb");
  
@@ -1308,99 +1389,42 @@ BMFH GetBMFH( const char* szFileNameIn )
         << "               File cannot be opened or does not exist." 
 	    << endl;
   }
-  bmfh.bfType = 0;
-  return bmfh;
+  return false;
  } 
- 
- SafeFread( (char*) &(bmfh.bfType) , sizeof(ebmpWORD) , 1 , fp );
- SafeFread( (char*) &(bmfh.bfSize) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmfh.bfReserved1) , sizeof(ebmpWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmfh.bfReserved2) , sizeof(ebmpWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmfh.bfOffBits) , sizeof(ebmpDWORD) , 1 , fp ); 
- 
+
+ ebmpBYTE Data[54];
+ int BytesRead = (int) fread( (char*) Data, 1, 54, fp );
  fclose( fp );
- 
- if( IsBigEndian() )
- { bmfh.SwitchEndianess(); }
+ return ParseBMPHeaders( Data, BytesRead, bmfh, bmih );
+}
 
+BMFH GetBMFH( const char* szFileNameIn )
+{
+ BMFH bmfh;
+ BMIH bmih;
+ if( !ReadBMPHeaders( szFileNameIn, bmfh, bmih ) )
+ { bmfh.bfType = 0; }
  return bmfh;
 }
 
 BMIH GetBMIH( const char* szFileNameIn )
 {
- using namespace std;
  BMFH bmfh;
  BMIH bmih;
-
- FILE* fp;
- fp = fopen( szFileNameIn,"rb");
-
- if( !fp  )
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: Cannot initialize from file " 
-        << szFileNameIn << "." << endl
-        << "               File cannot be opened or does not exist." 
-	    << endl;
-  }
-  return bmih;
- } 
- 
- // read the bmfh, i.e., first 14 bytes (just to get it out of the way);
- 
- ebmpBYTE TempBYTE;
- int i;
- for( i = 14 ; i > 0 ; i-- )
- { SafeFread( (char*) &TempBYTE , sizeof(ebmpBYTE) , 1, fp ); }
-
- // read the bmih 
-
- SafeFread( (char*) &(bmih.biSize) , sizeof(ebmpDWORD) , 1 , fp );
- SafeFread( (char*) &(bmih.biWidth) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biHeight) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biPlanes) , sizeof(ebmpWORD) , 1 , fp ); 
- 
- SafeFread( (char*) &(bmih.biBitCount) , sizeof(ebmpWORD) , 1 , fp );
- SafeFread( (char*) &(bmih.biCompression) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biSizeImage) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biXPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp ); 
- 
- SafeFread( (char*) &(bmih.biYPelsPerMeter) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biClrUsed) , sizeof(ebmpDWORD) , 1 , fp ); 
- SafeFread( (char*) &(bmih.biClrImportant) , sizeof(ebmpDWORD) , 1 , fp ); 
- 
- fclose( fp );
- 
- if( IsBigEndian() )
- { bmih.SwitchEndianess(); }
-
+ ReadBMPHeaders( szFileNameIn, bmfh, bmih );
  return bmih;
 }
 
 void DisplayBitmapInfo( const char* szFileNameIn )
 {
  using namespace std;
- FILE* fp;
- fp = fopen( szFileNameIn,"rb");
- 
- if( !fp  )
- {
-  if( EasyBMPwarnings )
-  {
-   cout << "EasyBMP Error: Cannot initialize from file " 
-        << szFileNameIn << "." << endl
-        << "               File cannot be opened or does not exist." 
-	    << endl;
-  }
-  return;
- } 
- fclose( fp );
 
- // don't duplicate work! Just use the functions from above!
+ // don't duplicate work! One read gets both headers.
  
- BMFH bmfh = GetBMFH(szFileNameIn);
- BMIH bmih = GetBMIH(szFileNameIn);
+ BMFH bmfh;
+ BMIH bmih;
+ if( !ReadBMPHeaders( szFileNameIn, bmfh, bmih ) )
+ { return; }
 
  cout << "File information for file " << szFileNameIn 
       << ":" << endl << endl;
@@ -1570,11 +1594,22 @@ bool BMP::Read32bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
 
 bool BMP::Read24bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
 { 
- int i;
+ int i, j;
  if( Width*3 > BufferSize )
  { return false; }
- for( i=0 ; i < Width ; i++ )
- { memcpy( (char*) &(Pixels[i][Row]), Buffer+3*i, 3 ); }
+ // widen a chunk at a time, then scatter into the columns; a 24-bit
+ // file has no alpha, which EasyBMP leaves 0
+ RGBApixel Chunk[64];
+ for( i=0 ; i < Width ; i += 64 )
+ {
+  int Count = Width-i < 64 ? Width-i : 64;
+  ConvertPixels( Buffer+3*i, BMP_BGR24, Chunk, BMP_BGRA32, Count );
+  for( j=0 ; j < Count ; j++ )
+  {
+   Pixels[i+j][Row] = Chunk[j];
+   Pixels[i+j][Row].Alpha = 0;
+  }
+ }
  return true;
 }
 
@@ -1583,62 +1618,615 @@ bool BMP::Read8bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row )
  int i;
  if( Width > BufferSize )
  { return false; }
+ // an 8-bit color table always has 256 entries, so every byte
+ // is a valid index and the table itself is the lookup table
  for( i=0 ; i < Width ; i++ )
- {
-  int Index = Buffer[i];
-  *( this->operator()(i,Row) )= GetColor(Index); 
- }
+ { Pixels[i][Row] = Colors[ Buffer[i] ]; }
  return true;
 }
 
 bool BMP::Read4bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row )
 {
- int Shifts[2] = {4  ,0 };
- int Masks[2]  = {240,15};
- 
  int i=0;
- int j;
  int k=0;
  if( Width > 2*BufferSize )
  { return false; }
- while( i < Width )
+ if( !DecodeTable )
+ { BuildDecodeTable(); }
+ // DecodeTable holds both pixels of every possible byte
+ while( i+1 < Width )
  {
-  j=0;
-  while( j < 2 && i < Width )
-  {
-   int Index = (int) ( (Buffer[k]&Masks[j]) >> Shifts[j]);
-   *( this->operator()(i,Row) )= GetColor(Index); 
-   i++; j++;   
-  }
-  k++;
+  const RGBApixel* Pair = DecodeTable + 2*Buffer[k];
+  Pixels[i][Row] = Pair[0];
+  Pixels[i+1][Row] = Pair[1];
+  i += 2; k++;
  }
+ if( i < Width )
+ { Pixels[i][Row] = DecodeTable[ 2*Buffer[k] ]; }
  return true;
 }
+
 bool BMP::Read1bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row )
 {
- int Shifts[8] = {7  ,6 ,5 ,4 ,3,2,1,0};
- int Masks[8]  = {128,64,32,16,8,4,2,1};
- 
  int i=0;
  int j;
  int k=0;
  
  if( Width > 8*BufferSize )
  { return false; }
+ if( !DecodeTable )
+ { BuildDecodeTable(); }
+ // DecodeTable holds all eight pixels of every possible byte
+ while( i+7 < Width )
+ {
+  const RGBApixel* Octet = DecodeTable + 8*Buffer[k];
+  for( j=0 ; j < 8 ; j++ )
+  { Pixels[i+j][Row] = Octet[j]; }
+  i += 8; k++;
+ }
+ for( j=0 ; i < Width ; i++, j++ )
+ { Pixels[i][Row] = DecodeTable[ 8*Buffer[k] + j ]; }
+ return true;
+}
+
+bool BMP::Read16bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
+{
+ int i;
+ if( Width*2 > BufferSize )
+ { return false; }
+ // words are assembled byte by byte, so no endian swap is needed
+ if( DecodeTable )
+ {
+  for( i=0 ; i < Width ; i++ )
+  {
+   ebmpWORD TempWORD = (ebmpWORD) ( Buffer[2*i] | ( Buffer[2*i+1] << 8 ) );
+   Pixels[i][Row] = DecodeTable[TempWORD];
+  }
+  return true;
+ }
+ for( i=0 ; i < Width ; i++ )
+ {
+  ebmpWORD TempWORD = (ebmpWORD) ( Buffer[2*i] | ( Buffer[2*i+1] << 8 ) );
+  Pixels[i][Row] = Decode16bitPixel( TempWORD );
+ }
+ return true;
+}
+
+RGBApixel BMP::Decode16bitPixel( ebmpWORD TempWORD )
+{
+ ebmpWORD Red = DecodeMasks[0] & TempWORD;
+ ebmpWORD Green = DecodeMasks[1] & TempWORD;
+ ebmpWORD Blue = DecodeMasks[2] & TempWORD;
+
+ RGBApixel Output;
+ Output.Red = (ebmpBYTE) 8*(Red>>DecodeShifts[0]);
+ Output.Green = (ebmpBYTE) 8*(Green>>DecodeShifts[1]);
+ Output.Blue = (ebmpBYTE) 8*(Blue>>DecodeShifts[2]);
+ Output.Alpha = 0;
+ return Output;
+}
+
+// Expands the color table (or, for 16-bit files, the bit field
+// masks) into a table indexed directly by the raw file data:
+//  1-bit: 256 bytes x 8 pixels, 4-bit: 256 bytes x 2 pixels,
+// 16-bit: one pixel for each of the 65536 possible words.
+// The 16-bit table only pays for itself on larger images.
+
+void BMP::BuildDecodeTable( void )
+{
+ int n,k;
+ FreeDecodeTable();
+ if( BitDepth == 1 )
+ {
+  DecodeTable = new RGBApixel [256*8];
+  for( n=0 ; n < 256 ; n++ )
+  {
+   for( k=0 ; k < 8 ; k++ )
+   { DecodeTable[8*n+k] = Colors[ (n >> (7-k)) & 1 ]; }
+  }
+ }
+ if( BitDepth == 4 )
+ {
+  DecodeTable = new RGBApixel [256*2];
+  for( n=0 ; n < 256 ; n++ )
+  {
+   DecodeTable[2*n] = Colors[ n >> 4 ];
+   DecodeTable[2*n+1] = Colors[ n & 15 ];
+  }
+ }
+ if( BitDepth == 16 && Width*Height >= 65536 )
+ {
+  DecodeTable = new RGBApixel [65536];
+  for( n=0 ; n < 65536 ; n++ )
+  { DecodeTable[n] = Decode16bitPixel( (ebmpWORD) n ); }
+ }
+}
+
+void BMP::SetDecodeMasks( ebmpWORD RedMask, ebmpWORD GreenMask, ebmpWORD BlueMask )
+{
+ // determine the red, green and blue shifts
+  
+ int GreenShift = 0; 
+ ebmpWORD TempShiftWORD = GreenMask;
+ while( TempShiftWORD > 31 )
+ { TempShiftWORD = TempShiftWORD>>1; GreenShift++; }  
+ int BlueShift = 0;
+ TempShiftWORD = BlueMask;
+ while( TempShiftWORD > 31 )
+ { TempShiftWORD = TempShiftWORD>>1; BlueShift++; }  
+ int RedShift = 0;  
+ TempShiftWORD = RedMask;
+ while( TempShiftWORD > 31 )
+ { TempShiftWORD = TempShiftWORD>>1; RedShift++; }  
+  
+ DecodeMasks[0] = RedMask;
+ DecodeMasks[1] = GreenMask;
+ DecodeMasks[2] = BlueMask;
+ DecodeShifts[0] = RedShift;
+ DecodeShifts[1] = GreenShift;
+ DecodeShifts[2] = BlueShift;
+}
+
+void BMP::FreeDecodeTable( void )
+{
+ if( DecodeTable )
+ { delete [] DecodeTable; }
+ DecodeTable = NULL;
+}
+
+bool BMP::ReadRow( ebmpBYTE* Buffer, int BufferSize, int Row )
+{
+ if( BitDepth == 1  )
+ { return Read1bitRow(  Buffer, BufferSize, Row ); }
+ if( BitDepth == 4  )
+ { return Read4bitRow(  Buffer, BufferSize, Row ); }
+ if( BitDepth == 8  )
+ { return Read8bitRow(  Buffer, BufferSize, Row ); }
+ if( BitDepth == 16 )
+ { return Read16bitRow( Buffer, BufferSize, Row ); }
+ if( BitDepth == 24 )
+ { return Read24bitRow( Buffer, BufferSize, Row ); }
+ if( BitDepth == 32 )
+ { return Read32bitRow( Buffer, BufferSize, Row ); }
+ return false;
+}
+
+static bool EasyBMPseek( FILE* fp, long long Offset )
+{
+#ifdef _WIN32
+ return _fseeki64( fp, Offset, SEEK_SET ) == 0;
+#else
+ return fseeko( fp, (off_t) Offset, SEEK_SET ) == 0;
+#endif
+}
+
+// Reads Height rows of BufferSize bytes starting at Offset. Row r of the
+// file is image row Height-1-r (or r for top-down files), so any range
+// of rows can be located without reading the ones before it. Files of
+// a few megabytes or more are split into one row range per thread, each
+// read through its own handle; the color and 16-bit decode tables are
+// read-only by then, and every thread writes its own rows.
+
+bool BMP::ReadRows( FILE* fp, const char* FileName, long long Offset, 
+                    int BufferSize, bool TopDown )
+{
+ const int MinimumBytesPerThread = 4 << 20;
+ const int ChunkBytes = 256 << 10;
+ 
+ int RowsPerThread = MinimumBytesPerThread / BufferSize + 1;
+ int Threads = EasyBMPthreadCount( GetEasyBMPthreads() );
+ if( Threads > Height / RowsPerThread )
+ { Threads = Height / RowsPerThread; }
+ if( Threads < 1 )
+ { Threads = 1; }
+ int ChunkRows = ChunkBytes / BufferSize;
+ if( ChunkRows < 1 )
+ { ChunkRows = 1; }
+
+ std::atomic<bool> Success( true );
+ EasyBMPparallelFor( 0, Height, Threads,
+  [&]( int Begin, int End )
+  {
+   FILE* Input = fp;
+   if( Threads > 1 )
+   {
+    Input = fopen( FileName, "rb" );
+    if( !Input || !EasyBMPseek( Input, Offset + (long long) Begin * BufferSize ) )
+    {
+     if( Input )
+     { fclose( Input ); }
+     Success = false;
+     return;
+    }
+   }
+   ebmpBYTE* Buffer = new ebmpBYTE [ (size_t) ChunkRows * BufferSize ];
+   for( int r=Begin ; r < End && Success ; r += ChunkRows )
+   {
+    int Rows = std::min( ChunkRows, End - r );
+    int BytesRead = (int) fread( (char*) Buffer, 1, (size_t) Rows * BufferSize, Input );
+    Rows = std::min( Rows, BytesRead / BufferSize );
+    for( int k=0 ; k < Rows ; k++ )
+    {
+     int Row = TopDown ? r+k : Height-1-(r+k);
+     if( !ReadRow( Buffer + (size_t) k * BufferSize, BufferSize, Row ) )
+     { Success = false; }
+    }
+    if( BytesRead < std::min( ChunkRows, End - r ) * BufferSize )
+    { Success = false; }
+   }
+   delete [] Buffer;
+   if( Input != fp )
+   { fclose( Input ); }
+  } );
+ return Success;
+}
+
+// Run-length decoding shared by RLE8 and RLE4. Next() returns the next
+// byte of the stream (or a negative value at the end of the data), and
+// EmitRow( FileRow ) is called once Indices holds a complete row of
+// palette indices, bottom row first. Pixels skipped by delta and
+// end-of-line codes are left at index 0.
+
+template <class NextByte, class EmitRowFunction>
+static bool DecodeRLE( NextByte Next, bool IsRLE4, int Width, int Height,
+                       ebmpBYTE* Indices, EmitRowFunction EmitRow )
+{
+ int x = 0;
+ int Row = 0;
+ memset( Indices, 0, Width );
+ while( Row < Height )
+ {
+  int First = Next();
+  int Second = Next();
+  if( First < 0 || Second < 0 )
+  { return false; }
+  
+  if( First > 0 )
+  {
+   // encoded run: First pixels of one index (RLE4: two alternating ones)
+   for( int k=0 ; k < First ; k++, x++ )
+   {
+    if( x < Width )
+    { Indices[x] = IsRLE4 ? ( (k&1) ? (Second & 15) : (Second >> 4) ) : Second; }
+   }
+  }
+  else if( Second == 0 || Second == 1 )
+  {
+   // end of line, or end of bitmap (which ends all remaining rows)
+   do
+   {
+    EmitRow( Row );
+    Row++;
+    memset( Indices, 0, Width );
+   }
+   while( Second == 1 && Row < Height );
+   x = 0;
+  }
+  else if( Second == 2 )
+  {
+   // delta: move right and up without touching the skipped pixels
+   int Right = Next();
+   int Up = Next();
+   if( Right < 0 || Up < 0 )
+   { return false; }
+   x += Right;
+   for( int k=0 ; k < Up && Row < Height ; k++ )
+   {
+    EmitRow( Row );
+    Row++;
+    memset( Indices, 0, Width );
+   }
+  }
+  else
+  {
+   // absolute mode: Second literal indices, padded to a word boundary
+   int Bytes = IsRLE4 ? (Second+1)/2 : Second;
+   int Data = 0;
+   for( int k=0 ; k < Second ; k++, x++ )
+   {
+    int Index;
+    if( IsRLE4 )
+    {
+     if( !(k&1) && (Data = Next()) < 0 )
+     { return false; }
+     Index = (k&1) ? (Data & 15) : (Data >> 4);
+    }
+    else
+    {
+     if( (Index = Next()) < 0 )
+     { return false; }
+    }
+    if( x < Width )
+    { Indices[x] = (ebmpBYTE) Index; }
+   }
+   if( Bytes % 2 && Next() < 0 )
+   { return false; }
+  }
+ }
+ return true;
+}
+
+// Encodes one row of palette indices. Runs of two or more become
+// encoded runs; other stretches of three or more pixels go out in
+// absolute mode. Returns the number of bytes written to Output, which
+// must hold at least 2*Width+4 bytes.
+
+static int EncodeRLERow( const ebmpBYTE* Indices, int Width, bool IsRLE4,
+                         bool LastRow, ebmpBYTE* Output )
+{
+ int Size = 0;
+ int i = 0;
  while( i < Width )
  {
-  j=0;
-  while( j < 8 && i < Width )
+  int Run = 1;
+  while( i+Run < Width && Run < 255 && Indices[i+Run] == Indices[i] )
+  { Run++; }
+  if( Run >= 2 )
   {
-   int Index = (int) ( (Buffer[k]&Masks[j]) >> Shifts[j]);
-   *( this->operator()(i,Row) )= GetColor(Index); 
-   i++; j++;   
+   Output[Size++] = (ebmpBYTE) Run;
+   Output[Size++] = IsRLE4 ? (ebmpBYTE) ( (Indices[i] << 4) | Indices[i] ) : Indices[i];
+   i += Run;
+   continue;
   }
-  k++;
+
+  // collect literals up to the start of the next run of three
+  int Literals = 0;
+  while( i+Literals < Width && Literals < 255 )
+  {
+   if( i+Literals+2 < Width && 
+       Indices[i+Literals] == Indices[i+Literals+1] && 
+       Indices[i+Literals] == Indices[i+Literals+2] )
+   { break; }
+   Literals++;
+  }
+  if( Literals < 3 )
+  {
+   for( int k=0 ; k < Literals ; k++ )
+   {
+    Output[Size++] = 1;
+    Output[Size++] = IsRLE4 ? (ebmpBYTE) (Indices[i+k] << 4) : Indices[i+k];
+   }
+  }
+  else
+  {
+   Output[Size++] = 0;
+   Output[Size++] = (ebmpBYTE) Literals;
+   int Bytes = 0;
+   if( IsRLE4 )
+   {
+    for( int k=0 ; k < Literals ; k += 2 )
+    {
+     int Low = ( k+1 < Literals ) ? Indices[i+k+1] : 0;
+     Output[Size++] = (ebmpBYTE) ( (Indices[i+k] << 4) | Low );
+     Bytes++;
+    }
+   }
+   else
+   {
+    for( int k=0 ; k < Literals ; k++ )
+    { Output[Size++] = Indices[i+k]; Bytes++; }
+   }
+   if( Bytes % 2 )
+   { Output[Size++] = 0; }
+  }
+  i += Literals;
+ }
+ Output[Size++] = 0;
+ Output[Size++] = LastRow ? 1 : 0;
+ return Size;
+}
+
+bool BMP::ReadRLEData( FILE* fp )
+{
+ bool IsRLE4 = ( Compression == 2 );
+ ebmpBYTE* Indices = new ebmpBYTE [Width];
+ bool Success = DecodeRLE( [fp]() { return getc( fp ); }, IsRLE4, Width, Height, Indices,
+  [this,Indices]( int FileRow )
+  {
+   int Row = Height-1-FileRow;
+   for( int i=0 ; i < Width ; i++ )
+   { Pixels[i][Row] = Colors[ Indices[i] ]; }
+  } );
+ delete [] Indices;
+ return Success;
+}
+
+// Decodes a complete BMP file image that is already in memory, e.g. one
+// read by a batch loader. Header checks, palette handling and warnings
+// are the same as ReadFromFile's; Size is the number of valid bytes.
+
+bool BMP::ReadFromMemory( const ebmpBYTE* Data, int Size )
+{ 
+ using namespace std;
+ const char* Name = "(memory image)";
+ 
+ BMFH bmfh;
+ BMIH bmih;
+ if( Size < 2 || Data[0] != 'B' || Data[1] != 'M' )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << Name 
+        << " is not a Windows BMP file!" << endl; 
+  }
+  return false;
+ }
+ if( !ParseBMPHeaders( Data, Size, bmfh, bmih ) )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << Name 
+        << " is obviously corrupted." << endl;
+  }
+  SetSize(1,1);
+  SetBitDepth(1);
+  return false;
+ } 
+ 
+ XPelsPerMeter = bmih.biXPelsPerMeter;
+ YPelsPerMeter = bmih.biYPelsPerMeter;
+ 
+ if( !EasyBMPcheckHeaders( bmih, Name ) )
+ {
+  SetSize(1,1);
+  SetBitDepth(1);
+  return false;
+ }
+
+ bool IsRLE = ( bmih.biCompression == 1 || bmih.biCompression == 2 );
+ bool TopDown = ( (int) bmih.biHeight < 0 );
+ SetBitDepth( (int) bmih.biBitCount ); 
+ SetSize( (int) bmih.biWidth , TopDown ? -(int) bmih.biHeight : (int) bmih.biHeight );
+ 
+ // the palette (or the 16-bit masks) follows the 54 header bytes, 
+ // and the pixels start wherever ReadFromFile would be after them
+ 
+ int Position = 54;
+ int DataOffset = (int) bmfh.bfOffBits;
+ if( BitDepth < 16 )
+ {
+  int NumberOfColorsToRead = ( DataOffset - 54 )/4;  
+  if( NumberOfColorsToRead > TellNumberOfColors() )
+  { NumberOfColorsToRead = TellNumberOfColors(); }
+  if( NumberOfColorsToRead < 0 )
+  { NumberOfColorsToRead = 0; }
+  if( 54 + 4*NumberOfColorsToRead > Size )
+  { NumberOfColorsToRead = ( Size - 54 )/4; }
+ 
+  if( NumberOfColorsToRead < TellNumberOfColors() && EasyBMPwarnings )
+  {
+   cout << "EasyBMP Warning: file " << Name << " has an underspecified" << endl
+        << "                 color table. The table will be padded with extra" << endl
+        << "                 white (255,255,255,0) entries." << endl;
+  }
+ 
+  int n;
+  for( n=0; n < NumberOfColorsToRead ; n++ )
+  { memcpy( (char*) &(Colors[n]), Data + 54 + 4*n, 4 ); }
+  for( n=NumberOfColorsToRead ; n < TellNumberOfColors() ; n++ )
+  {
+   RGBApixel WHITE; 
+   WHITE.Red = 255;
+   WHITE.Green = 255;
+   WHITE.Blue = 255;
+   WHITE.Alpha = 0;
+   SetColor( n , WHITE );
+  }
+  Position += 4*NumberOfColorsToRead;
+ }
+ 
+ if( BitDepth == 16 )
+ {
+  ebmpWORD BlueMask = 31; 
+  ebmpWORD GreenMask = 992; 
+  ebmpWORD RedMask = 31744; 
+  if( bmih.biCompression != 0 && Size >= 66 )
+  {
+   RedMask = HeaderWORD( Data+54 );
+   GreenMask = HeaderWORD( Data+58 );
+   BlueMask = HeaderWORD( Data+62 );
+   Position += 12;
+  }
+  SetDecodeMasks( RedMask, GreenMask, BlueMask );
+ }
+ 
+ if( Position < DataOffset )
+ {
+  if( EasyBMPwarnings && BitDepth != 16 )
+  {
+   cout << "EasyBMP Warning: Extra meta data detected in file " << Name << endl
+        << "                 Data will be skipped." << endl;
+  }
+  Position = DataOffset;
+ }
+ if( Position > Size )
+ { Position = Size; }
+ const ebmpBYTE* Pointer = Data + Position;
+ const ebmpBYTE* End = Data + Size;
+ 
+ bool Success = true;
+ Compression = 0;
+ if( IsRLE )
+ {
+  Compression = (int) bmih.biCompression;
+  bool IsRLE4 = ( Compression == 2 );
+  ebmpBYTE* Indices = new ebmpBYTE [Width];
+  Success = DecodeRLE( [&Pointer,End]() { return Pointer < End ? (int) *Pointer++ : -1; }, 
+                       IsRLE4, Width, Height, Indices,
+   [this,Indices]( int FileRow )
+   {
+    int Row = Height-1-FileRow;
+    for( int i=0 ; i < Width ; i++ )
+    { Pixels[i][Row] = Colors[ Indices[i] ]; }
+   } );
+  delete [] Indices;
+ }
+ else
+ {
+  int BufferSize = (int) ( (Width*BitDepth) / 8.0 );
+  while( 8*BufferSize < Width*BitDepth )
+  { BufferSize++; }
+  while( BufferSize % 4 )
+  { BufferSize++; }
+
+  // the row readers only read the buffer, so rows are decoded in place
+  BuildDecodeTable();
+  for( int r=0 ; r < Height && Success ; r++ )
+  {
+   if( End - Pointer < BufferSize )
+   { Success = false; break; }
+   int Row = TopDown ? r : Height-1-r;
+   Success = ReadRow( (ebmpBYTE*) Pointer, BufferSize, Row );
+   Pointer += BufferSize;
+  }
+  FreeDecodeTable();
+ }
+ 
+ if( !Success && EasyBMPwarnings )
+ {
+  cout << "EasyBMP Error: Could not read proper amount of data." << endl;
  }
  return true;
 }
 
+int BMP::WriteRLEData( FILE* fp )
+{
+ bool IsRLE4 = ( Compression == 2 );
+ int BufferSize = ( Width + 1 ) / 2 + 4;
+ if( !IsRLE4 )
+ { BufferSize = Width + 4; }
+ ebmpBYTE* Buffer = new ebmpBYTE [BufferSize];
+ ebmpBYTE* Indices = new ebmpBYTE [Width];
+ ebmpBYTE* Output = new ebmpBYTE [2*Width+4];
+ 
+ int DataSize = 0;
+ for( int j=Height-1 ; j >= 0 && DataSize >= 0 ; j-- )
+ {
+  // reuse the uncompressed row writers for the palette lookup
+  if( IsRLE4 )
+  {
+   Write4bitRow( Buffer, BufferSize, j );
+   for( int i=0 ; i < Width ; i++ )
+   { Indices[i] = (i&1) ? (Buffer[i/2] & 15) : (Buffer[i/2] >> 4); }
+  }
+  else
+  {
+   Write8bitRow( Buffer, BufferSize, j );
+   memcpy( Indices, Buffer, Width );
+  }
+  int Size = EncodeRLERow( Indices, Width, IsRLE4, j == 0, Output );
+  if( (int) fwrite( (char*) Output, 1, Size, fp ) != Size )
+  { DataSize = -1; }
+  else
+  { DataSize += Size; }
+ }
+ 
+ delete [] Output;
+ delete [] Indices;
+ delete [] Buffer;
+ return DataSize;
+}
+
 bool BMP::Write32bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
 { 
  int i;
@@ -1651,11 +2239,18 @@ bool BMP::Write32bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
 
 bool BMP::Write24bitRow( ebmpBYTE* Buffer, int BufferSize, int Row )
 { 
- int i;
+ int i, j;
  if( Width*3 > BufferSize )
  { return false; }
- for( i=0 ; i < Width ; i++ )
- { memcpy( (char*) Buffer+3*i,  (char*) &(Pixels[i][Row]), 3 ); }
+ // gather a chunk of the row from the columns, then narrow it
+ RGBApixel Chunk[64];
+ for( i=0 ; i < Width ; i += 64 )
+ {
+  int Count = Width-i < 64 ? Width-i : 64;
+  for( j=0 ; j < Count ; j++ )
+  { Chunk[j] = Pixels[i+j][Row]; }
+  ConvertPixels( Chunk, BMP_BGRA32, Buffer+3*i, BMP_BGR24, Count );
+ }
  return true;
 }
 
@@ -1664,8 +2259,17 @@ bool BMP::Write8bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row )
  int i;
  if( Width > BufferSize )
  { return false; }
+ // quantized and dithered images are made of long runs of palette
+ // colors, so reuse the previous match whenever the color repeats
  for( i=0 ; i < Width ; i++ )
- { Buffer[i] = FindClosestColor( Pixels[i][Row] ); }
+ {
+  if( i > 0 && Pixels[i][Row].Red == Pixels[i-1][Row].Red &&
+      Pixels[i][Row].Green == Pixels[i-1][Row].Green &&
+      Pixels[i][Row].Blue == Pixels[i-1][Row].Blue )
+  { Buffer[i] = Buffer[i-1]; }
+  else
+  { Buffer[i] = FindClosestColor( Pixels[i][Row] ); }
+ }
  return true;
 }
 
@@ -1717,6 +2321,32 @@ bool BMP::Write1bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row )
  return true;
 }
 
+// While a palettized file is being written, FindClosestColor remembers
+// its answers in a small direct-mapped table keyed by the exact color.
+// Dithered images use only palette colors but rarely repeat them in
+// runs, so this turns most of the palette scans into a single probe.
+
+const int ColorLookupSize = 4096;
+
+void BMP::BeginColorLookup( void )
+{
+ EndColorLookup();
+ ColorLookupKeys = new ebmpDWORD [ColorLookupSize];
+ ColorLookupValues = new ebmpBYTE [ColorLookupSize];
+ for( int n=0 ; n < ColorLookupSize ; n++ )
+ { ColorLookupKeys[n] = 0xFFFFFFFF; }
+}
+
+void BMP::EndColorLookup( void )
+{
+ if( ColorLookupKeys )
+ { delete [] ColorLookupKeys; }
+ if( ColorLookupValues )
+ { delete [] ColorLookupValues; }
+ ColorLookupKeys = NULL;
+ ColorLookupValues = NULL;
+}
+
 ebmpBYTE BMP::FindClosestColor( RGBApixel& input )
 {
  using namespace std;
@@ -1725,10 +2355,18 @@ ebmpBYTE BMP::FindClosestColor( RGBApixel& input )
  int NumberOfColors = TellNumberOfColors();
  ebmpBYTE BestI = 0;
  int BestMatch = 999999;
+ if( !Colors )
+ { return BestI; }
+
+ ebmpDWORD Key = ( (ebmpDWORD) input.Red << 16 ) 
+               | ( (ebmpDWORD) input.Green << 8 ) | input.Blue;
+ int Slot = (int) ( ( Key * 2654435761u ) >> 20 ) & (ColorLookupSize-1);
+ if( ColorLookupKeys && ColorLookupKeys[Slot] == Key )
+ { return ColorLookupValues[Slot]; }
   
  while( i < NumberOfColors )
  {
-  RGBApixel Attempt = GetColor( i );
+  const RGBApixel& Attempt = Colors[i];
   int TempMatch = IntSquare( (int) Attempt.Red - (int) input.Red )
                 + IntSquare( (int) Attempt.Green - (int) input.Green )
                 + IntSquare( (int) Attempt.Blue - (int) input.Blue );
@@ -1738,6 +2376,11 @@ ebmpBYTE BMP::FindClosestColor( RGBApixel& input )
   { i = NumberOfColors; }
   i++;
  }
+ if( ColorLookupKeys )
+ {
+  ColorLookupKeys[Slot] = Key;
+  ColorLookupValues[Slot] = BestI;
+ }
  return BestI;
 }
 
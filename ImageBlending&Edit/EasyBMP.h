@@ -68,6 +68,13 @@
 #include "EasyBMP_DataStructures.h"
 #include "EasyBMP_BMP.h"
 #include "EasyBMP_VariousBMPutilities.h"
+#include "EasyBMP_Convert.h"
+#include "EasyBMP_Quantize.h"
+#include "EasyBMP_Probe.h"
+#include "EasyBMP_Loader.h"
+#include "EasyBMP_Cache.h"
+#include "EasyBMP_ResultCache.h"
+#include "EasyBMP_Tiled.h"
 
 #ifndef _EasyBMP_Version_
 #define _EasyBMP_Version_ 1.06
@@ -83,4 +90,10 @@ void SetEasyBMPwarningsOff( void );
 void SetEasyBMPwarningsOn( void );
 bool GetEasyBMPwarningState( void );
 
+// number of threads used to decode large files; 0 (the default)
+// means one per core
+
+void SetEasyBMPthreads( int NumberOfThreads );
+int GetEasyBMPthreads( void );
+
 #endif
@@ -39,12 +39,31 @@ class BMP
  int SizeOfMetaData1;
  ebmpBYTE* MetaData2;
  int SizeOfMetaData2;
+
+ ebmpDWORD* ColorLookupKeys;
+ ebmpBYTE* ColorLookupValues;
+
+ int Compression;
+
+ RGBApixel* DecodeTable;
+ ebmpWORD DecodeMasks[3];
+ int DecodeShifts[3];
    
  bool Read32bitRow( ebmpBYTE* Buffer, int BufferSize, int Row );   
  bool Read24bitRow( ebmpBYTE* Buffer, int BufferSize, int Row );   
  bool Read8bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row );  
  bool Read4bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row );  
  bool Read1bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row );
+ bool Read16bitRow( ebmpBYTE* Buffer, int BufferSize, int Row );
+ bool ReadRow( ebmpBYTE* Buffer, int BufferSize, int Row );
+ bool ReadRows( FILE* fp, const char* FileName, long long Offset, 
+                int BufferSize, bool TopDown );
+ RGBApixel Decode16bitPixel( ebmpWORD TempWORD );
+ void SetDecodeMasks( ebmpWORD RedMask, ebmpWORD GreenMask, ebmpWORD BlueMask );
+ void BuildDecodeTable( void );
+ void FreeDecodeTable( void );
+ bool ReadRLEData( FILE* fp );
+ int WriteRLEData( FILE* fp );
    
  bool Write32bitRow( ebmpBYTE* Buffer, int BufferSize, int Row );   
  bool Write24bitRow( ebmpBYTE* Buffer, int BufferSize, int Row );   
@@ -53,13 +72,17 @@ class BMP
  bool Write1bitRow(  ebmpBYTE* Buffer, int BufferSize, int Row );
  
  ebmpBYTE FindClosestColor( RGBApixel& input );
+ void BeginColorLookup( void );
+ void EndColorLookup( void );
 
  public: 
 
- int TellBitDepth( void );
- int TellWidth( void );
- int TellHeight( void );
- int TellNumberOfColors( void );
+ int TellBitDepth( void ) const;
+ int TellWidth( void ) const;
+ int TellHeight( void ) const;
+ int TellNumberOfColors( void ) const;
+ int TellCompression( void ) const;
+ bool SetCompression( int NewCompression );
  void SetDPI( int HorizontalDPI, int VerticalDPI );
  int TellVerticalDPI( void );
  int TellHorizontalDPI( void );
@@ -71,6 +94,10 @@ class BMP
  
  RGBApixel GetPixel( int i, int j ) const;
  bool SetPixel( int i, int j, RGBApixel NewPixel );
+ // the Height pixels of column i, top to bottom, contiguous; no range
+ // checks, unlike the accessors above
+ RGBApixel* Column( int i );
+ const RGBApixel* Column( int i ) const;
  
  bool CreateStandardColorTable( void );
  
@@ -78,8 +105,9 @@ class BMP
  bool SetBitDepth( int NewDepth );
  bool WriteToFile( const char* FileName );
  bool ReadFromFile( const char* FileName );
+ bool ReadFromMemory( const ebmpBYTE* Data, int Size );
  
- RGBApixel GetColor( int ColorNumber );
+ RGBApixel GetColor( int ColorNumber ) const;
  bool SetColor( int ColorNumber, RGBApixel NewColor ); 
 };
 
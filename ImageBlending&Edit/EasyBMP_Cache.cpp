@@ -0,0 +1,222 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Cache.cpp               *
+*                                                *
+* description: An in-process LRU cache of        *
+*              decoded images                    *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Cache.h"
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+// what a decoded image costs in memory: the pixels, the column
+// pointers and the color table
+
+long long ImageBytes( const BMP& Image )
+{
+ long long Bytes = (long long) Image.TellWidth() * Image.TellHeight() * sizeof(RGBApixel)
+                 + (long long) Image.TellWidth() * sizeof(RGBApixel*) + sizeof(BMP);
+ if( Image.TellBitDepth() < 16 )
+ { Bytes += (long long) Image.TellNumberOfColors() * sizeof(RGBApixel); }
+ return Bytes;
+}
+
+}
+
+BMPCache::BMPCache( long long NewByteBudget )
+{
+ ByteBudget = NewByteBudget;
+ BytesUsed = 0;
+ Hits = 0;
+ Misses = 0;
+}
+
+std::shared_ptr<const BMP> BMPCache::Load( const std::string& FileName )
+{
+ using namespace std;
+ long long FileSize, ModificationTime;
+ if( !StatBMPFile( FileName.c_str(), FileSize, ModificationTime ) )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Cannot open file "
+        << FileName << " for input." << endl;
+  }
+  lock_guard<mutex> Guard( Lock );
+  EraseLocked( FileName );
+  Misses++;
+  return shared_ptr<const BMP>();
+ }
+
+ // if another thread is already decoding this file, wait for it
+ // rather than decoding it a second time
+ unique_lock<mutex> Guard( Lock );
+ for( ;; )
+ {
+  shared_ptr<const BMP> Image = FindLocked( FileName, FileSize, ModificationTime );
+  if( Image )
+  {
+   Hits++;
+   return Image;
+  }
+  if( Loading.count( FileName ) == 0 )
+  { break; }
+  LoadFinished.wait( Guard );
+ }
+ Misses++;
+ Loading.insert( FileName );
+ Guard.unlock();
+
+ shared_ptr<BMP> Image( new BMP );
+ bool Success = Image->ReadFromFile( FileName.c_str() );
+
+ // only cache what was read from an unchanged file
+ long long SizeAfter = -1, TimeAfter = -1;
+ bool Unchanged = Success &&
+                  StatBMPFile( FileName.c_str(), SizeAfter, TimeAfter ) &&
+                  SizeAfter == FileSize && TimeAfter == ModificationTime;
+
+ Guard.lock();
+ Loading.erase( FileName );
+ LoadFinished.notify_all();
+ if( !Success )
+ { return shared_ptr<const BMP>(); }
+ if( !Unchanged )
+ { return Image; }
+ return InsertLocked( FileName, Image, FileSize, ModificationTime );
+}
+
+std::shared_ptr<const BMP> BMPCache::Find( const std::string& FileName )
+{
+ long long FileSize = -1, ModificationTime = -1;
+ bool Exists = StatBMPFile( FileName.c_str(), FileSize, ModificationTime );
+ std::lock_guard<std::mutex> Guard( Lock );
+ if( !Exists )
+ {
+  EraseLocked( FileName );
+  Misses++;
+  return std::shared_ptr<const BMP>();
+ }
+ std::shared_ptr<const BMP> Image = FindLocked( FileName, FileSize, ModificationTime );
+ if( Image )
+ { Hits++; }
+ else
+ { Misses++; }
+ return Image;
+}
+
+std::shared_ptr<const BMP> BMPCache::Insert( const std::string& FileName,
+                                             std::unique_ptr<BMP> Image,
+                                             long long FileSize, long long ModificationTime )
+{
+ std::shared_ptr<const BMP> Shared( std::move( Image ) );
+ if( !Shared || FileSize < 0 )
+ { return Shared; }
+ std::lock_guard<std::mutex> Guard( Lock );
+ return InsertLocked( FileName, Shared, FileSize, ModificationTime );
+}
+
+std::shared_ptr<const BMP> BMPCache::FindLocked( const std::string& FileName,
+                                                 long long FileSize, long long ModificationTime )
+{
+ std::unordered_map<std::string,Entry>::iterator it = Entries.find( FileName );
+ if( it == Entries.end() )
+ { return std::shared_ptr<const BMP>(); }
+ if( it->second.FileSize != FileSize || it->second.ModificationTime != ModificationTime )
+ {
+  EraseLocked( FileName );
+  return std::shared_ptr<const BMP>();
+ }
+ Recent.splice( Recent.begin(), Recent, it->second.Position );
+ return it->second.Image;
+}
+
+std::shared_ptr<const BMP> BMPCache::InsertLocked( const std::string& FileName,
+                                                   std::shared_ptr<const BMP> Image,
+                                                   long long FileSize, long long ModificationTime )
+{
+ EraseLocked( FileName );
+ long long Bytes = ImageBytes( *Image );
+ if( Bytes > ByteBudget )
+ { return Image; }
+
+ Recent.push_front( FileName );
+ Entry& NewEntry = Entries[FileName];
+ NewEntry.Image = Image;
+ NewEntry.FileSize = FileSize;
+ NewEntry.ModificationTime = ModificationTime;
+ NewEntry.Bytes = Bytes;
+ NewEntry.Position = Recent.begin();
+ BytesUsed += Bytes;
+ EvictLocked();
+ return Image;
+}
+
+void BMPCache::EraseLocked( const std::string& FileName )
+{
+ std::unordered_map<std::string,Entry>::iterator it = Entries.find( FileName );
+ if( it == Entries.end() )
+ { return; }
+ BytesUsed -= it->second.Bytes;
+ Recent.erase( it->second.Position );
+ Entries.erase( it );
+}
+
+void BMPCache::EvictLocked( void )
+{
+ while( BytesUsed > ByteBudget && !Recent.empty() )
+ { EraseLocked( Recent.back() ); }
+}
+
+void BMPCache::SetByteBudget( long long NewByteBudget )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ ByteBudget = NewByteBudget;
+ EvictLocked();
+}
+
+void BMPCache::Clear( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ Entries.clear();
+ Recent.clear();
+ BytesUsed = 0;
+}
+
+long long BMPCache::TellByteBudget( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ return ByteBudget;
+}
+
+long long BMPCache::TellBytesUsed( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ return BytesUsed;
+}
+
+int BMPCache::TellNumberOfEntries( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ return (int) Entries.size();
+}
+
+long long BMPCache::TellHits( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ return Hits;
+}
+
+long long BMPCache::TellMisses( void )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ return Misses;
+}
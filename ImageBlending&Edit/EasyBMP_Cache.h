@@ -0,0 +1,89 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Cache.h                 *
+*                                                *
+* description: An in-process LRU cache of        *
+*              decoded images                    *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Cache_h_
+#define _EasyBMP_Cache_h_
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Decoded images keyed by path and checked against the file's size and
+// modification time on every lookup, so an edited file is never served
+// stale. Images are handed out as shared read-only handles: any number
+// of jobs can hold the same decoded copy, and evicting an entry only
+// drops the cache's reference. When the images held exceed ByteBudget,
+// the least recently used ones are evicted. All members are thread-safe.
+
+class BMPCache
+{
+ public:
+ BMPCache( long long ByteBudget );
+
+ // Returns the cached image, decoding the file on a miss. Concurrent
+ // calls for the same file decode it once. Empty if it can't be read.
+ std::shared_ptr<const BMP> Load( const std::string& FileName );
+
+ // Lookup only; empty on a miss or a stale entry.
+ std::shared_ptr<const BMP> Find( const std::string& FileName );
+
+ // Adds an image decoded elsewhere (e.g. by a BMPBatchLoader) and
+ // returns the handle the cache now shares. FileSize and
+ // ModificationTime must be those of the file before it was read, as
+ // BMPLoadResult has them, so a file rewritten during the read is never
+ // served as fresh; with FileSize < 0 the image is not cached.
+ std::shared_ptr<const BMP> Insert( const std::string& FileName,
+                                    std::unique_ptr<BMP> Image,
+                                    long long FileSize, long long ModificationTime );
+
+ void SetByteBudget( long long NewByteBudget );
+ void Clear( void );
+
+ long long TellByteBudget( void );
+ long long TellBytesUsed( void );
+ int TellNumberOfEntries( void );
+ long long TellHits( void );
+ long long TellMisses( void );
+
+ private:
+ struct Entry
+ {
+  std::shared_ptr<const BMP> Image;
+  long long FileSize;
+  long long ModificationTime;
+  long long Bytes;
+  std::list<std::string>::iterator Position;
+ };
+
+ std::shared_ptr<const BMP> FindLocked( const std::string& FileName,
+                                        long long FileSize, long long ModificationTime );
+ std::shared_ptr<const BMP> InsertLocked( const std::string& FileName,
+                                          std::shared_ptr<const BMP> Image,
+                                          long long FileSize, long long ModificationTime );
+ void EraseLocked( const std::string& FileName );
+ void EvictLocked( void );
+
+ std::mutex Lock;
+ std::condition_variable LoadFinished;
+ std::unordered_map<std::string,Entry> Entries;
+ std::unordered_set<std::string> Loading;
+ std::list<std::string> Recent; // most recently used first
+ long long ByteBudget;
+ long long BytesUsed;
+ long long Hits;
+ long long Misses;
+};
+
+#endif
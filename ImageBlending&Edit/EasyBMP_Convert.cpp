@@ -0,0 +1,391 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Convert.cpp             *
+*                                                *
+* description: Conversions between the pixel     *
+*              formats of files, RGBApixel,      *
+*              displays and float images         *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Convert.h"
+
+// The SIMD paths are for x86-64, where SSE2 is always there; SSSE3 and
+// AVX2 are looked for at run time. GCC and Clang compile each path for
+// its own instruction set, MSVC compiles intrinsics as they come.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define EasyBMP_CONVERT_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define EasyBMP_TARGET_SSSE3
+#define EasyBMP_TARGET_AVX2
+#else
+#define EasyBMP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define EasyBMP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+
+// where a byte format keeps R, G, B and A (-1: it has no alpha)
+
+struct ByteLayout
+{
+ int Size;
+ int Offset[4];
+};
+
+const ByteLayout ByteLayouts[3] =
+{
+ { 3, { 2, 1, 0, -1 } }, // BMP_BGR24
+ { 4, { 2, 1, 0, 3 } },  // BMP_BGRA32
+ { 4, { 0, 1, 2, 3 } }   // BMP_RGBA8
+};
+
+enum ConversionPath { PathScalar, PathSSSE3, PathAVX2 };
+
+// The scalar conversions. The SIMD loops leave the last few pixels of a
+// call to these.
+
+void BytesToBytes( const ebmpBYTE* Input, const ByteLayout& In,
+                   ebmpBYTE* Output, const ByteLayout& Out, int N )
+{
+ int i, c;
+ for( i=0 ; i < N ; i++ )
+ {
+  for( c=0 ; c < 4 ; c++ )
+  {
+   if( Out.Offset[c] < 0 )
+   { continue; }
+   Output[ Out.Offset[c] ] = In.Offset[c] < 0 ? 255 : Input[ In.Offset[c] ];
+  }
+  Input += In.Size;
+  Output += Out.Size;
+ }
+}
+
+void BytesToFloats( const ebmpBYTE* Input, const ByteLayout& In, float* Output, int N )
+{
+ int i, c;
+ for( i=0 ; i < N ; i++ )
+ {
+  for( c=0 ; c < 4 ; c++ )
+  { Output[c] = In.Offset[c] < 0 ? 1.0f : Input[ In.Offset[c] ] / 255.0f; }
+  Input += In.Size;
+  Output += 4;
+ }
+}
+
+// clamp, then round half up; written so that NaN gives 0, as the SIMD
+// min/max sequence does
+inline ebmpBYTE FloatToByte( float Value )
+{
+ Value *= 255.0f;
+ if( !( Value > 0.0f ) )
+ { return 0; }
+ if( Value >= 255.0f )
+ { return 255; }
+ return (ebmpBYTE) (int) ( Value + 0.5f );
+}
+
+void FloatsToBytes( const float* Input, ebmpBYTE* Output, const ByteLayout& Out, int N )
+{
+ int i, c;
+ for( i=0 ; i < N ; i++ )
+ {
+  for( c=0 ; c < 4 ; c++ )
+  {
+   if( Out.Offset[c] >= 0 )
+   { Output[ Out.Offset[c] ] = FloatToByte( Input[c] ); }
+  }
+  Input += 4;
+  Output += Out.Size;
+ }
+}
+
+#ifdef EasyBMP_CONVERT_SIMD
+
+// The pshufb control (and the bytes to OR in afterwards) that turns 4
+// pixels of In into 4 pixels of Out. A 3-byte output fills 12 bytes and
+// zeroes the other 4.
+
+void BuildShuffle( const ByteLayout& In, const ByteLayout& Out,
+                   ebmpBYTE Control[16], ebmpBYTE Fill[16] )
+{
+ int i, p, c;
+ for( i=0 ; i < 16 ; i++ )
+ {
+  Control[i] = 0x80;
+  Fill[i] = 0;
+ }
+ for( p=0 ; p < 4 ; p++ )
+ {
+  for( c=0 ; c < 4 ; c++ )
+  {
+   if( Out.Offset[c] < 0 )
+   { continue; }
+   int Position = p*Out.Size + Out.Offset[c];
+   if( In.Offset[c] < 0 )
+   { Fill[Position] = 255; }
+   else
+   { Control[Position] = (ebmpBYTE) ( p*In.Size + In.Offset[c] ); }
+  }
+ }
+}
+
+// A 16-byte load or store of 4 pixels of a 3-byte format touches the
+// next 4 bytes too, so those loops stop while 2 more pixels remain.
+
+inline int SafePixels( const ByteLayout& A, const ByteLayout& B )
+{ return ( A.Size == 3 || B.Size == 3 ) ? 6 : 4; }
+
+// Each SIMD routine converts as many whole groups of pixels as it
+// safely can and returns how many pixels that was.
+
+EasyBMP_TARGET_SSSE3
+int BytesToBytesSSSE3( const ebmpBYTE* Input, const ByteLayout& In,
+                       ebmpBYTE* Output, const ByteLayout& Out, int N )
+{
+ ebmpBYTE Control[16], Fill[16];
+ BuildShuffle( In, Out, Control, Fill );
+ __m128i ShuffleControl = _mm_loadu_si128( (const __m128i*) Control );
+ __m128i FillBytes = _mm_loadu_si128( (const __m128i*) Fill );
+ int Reach = SafePixels( In, Out );
+ int i = 0;
+ for( ; i + Reach <= N ; i += 4 )
+ {
+  __m128i Pixels = _mm_loadu_si128( (const __m128i*) ( Input + i*In.Size ) );
+  Pixels = _mm_or_si128( _mm_shuffle_epi8( Pixels, ShuffleControl ), FillBytes );
+  _mm_storeu_si128( (__m128i*) ( Output + i*Out.Size ), Pixels );
+ }
+ return i;
+}
+
+EasyBMP_TARGET_SSSE3
+int BytesToFloatsSSSE3( const ebmpBYTE* Input, const ByteLayout& In, float* Output, int N )
+{
+ ebmpBYTE Control[16], Fill[16];
+ BuildShuffle( In, ByteLayouts[BMP_RGBA8], Control, Fill );
+ __m128i ShuffleControl = _mm_loadu_si128( (const __m128i*) Control );
+ __m128i FillBytes = _mm_loadu_si128( (const __m128i*) Fill );
+ __m128i Zero = _mm_setzero_si128();
+ __m128 Scale = _mm_set1_ps( 255.0f );
+ int Reach = SafePixels( In, In );
+ int i = 0;
+ for( ; i + Reach <= N ; i += 4 )
+ {
+  __m128i Pixels = _mm_loadu_si128( (const __m128i*) ( Input + i*In.Size ) );
+  Pixels = _mm_or_si128( _mm_shuffle_epi8( Pixels, ShuffleControl ), FillBytes );
+  __m128i Low = _mm_unpacklo_epi8( Pixels, Zero );
+  __m128i High = _mm_unpackhi_epi8( Pixels, Zero );
+  float* Out = Output + 4*i;
+  // dividing (not multiplying by 1/255) gives exactly b/255.0f
+  _mm_storeu_ps( Out, _mm_div_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( Low, Zero ) ), Scale ) );
+  _mm_storeu_ps( Out + 4, _mm_div_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( Low, Zero ) ), Scale ) );
+  _mm_storeu_ps( Out + 8, _mm_div_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( High, Zero ) ), Scale ) );
+  _mm_storeu_ps( Out + 12, _mm_div_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( High, Zero ) ), Scale ) );
+ }
+ return i;
+}
+
+EasyBMP_TARGET_SSSE3
+int FloatsToBytesSSSE3( const float* Input, ebmpBYTE* Output, const ByteLayout& Out, int N )
+{
+ ebmpBYTE Control[16], Fill[16];
+ BuildShuffle( ByteLayouts[BMP_RGBA8], Out, Control, Fill );
+ __m128i ShuffleControl = _mm_loadu_si128( (const __m128i*) Control );
+ __m128 Scale = _mm_set1_ps( 255.0f );
+ __m128 Zero = _mm_setzero_ps();
+ __m128 Half = _mm_set1_ps( 0.5f );
+ int Reach = SafePixels( Out, Out );
+ int i = 0;
+ for( ; i + Reach <= N ; i += 4 )
+ {
+  __m128i Channels[4];
+  int k;
+  for( k=0 ; k < 4 ; k++ )
+  {
+   __m128 Value = _mm_mul_ps( _mm_loadu_ps( Input + 4*(i+k) ), Scale );
+   Value = _mm_min_ps( _mm_max_ps( Value, Zero ), Scale );
+   Channels[k] = _mm_cvttps_epi32( _mm_add_ps( Value, Half ) );
+  }
+  __m128i Pixels = _mm_packus_epi16( _mm_packs_epi32( Channels[0], Channels[1] ),
+                                     _mm_packs_epi32( Channels[2], Channels[3] ) );
+  _mm_storeu_si128( (__m128i*) ( Output + i*Out.Size ), _mm_shuffle_epi8( Pixels, ShuffleControl ) );
+ }
+ return i;
+}
+
+EasyBMP_TARGET_AVX2
+int BytesToFloatsAVX2( const ebmpBYTE* Input, const ByteLayout& In, float* Output, int N )
+{
+ ebmpBYTE Control[16], Fill[16];
+ BuildShuffle( In, ByteLayouts[BMP_RGBA8], Control, Fill );
+ __m128i ShuffleControl = _mm_loadu_si128( (const __m128i*) Control );
+ __m128i FillBytes = _mm_loadu_si128( (const __m128i*) Fill );
+ __m256 Scale = _mm256_set1_ps( 255.0f );
+ int Reach = SafePixels( In, In );
+ int i = 0;
+ for( ; i + Reach <= N ; i += 4 )
+ {
+  __m128i Pixels = _mm_loadu_si128( (const __m128i*) ( Input + i*In.Size ) );
+  Pixels = _mm_or_si128( _mm_shuffle_epi8( Pixels, ShuffleControl ), FillBytes );
+  float* Out = Output + 4*i;
+  _mm256_storeu_ps( Out, _mm256_div_ps( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( Pixels ) ), Scale ) );
+  _mm256_storeu_ps( Out + 8, _mm256_div_ps( _mm256_cvtepi32_ps(
+                    _mm256_cvtepu8_epi32( _mm_srli_si128( Pixels, 8 ) ) ), Scale ) );
+ }
+ return i;
+}
+
+EasyBMP_TARGET_AVX2
+int FloatsToBytesAVX2( const float* Input, ebmpBYTE* Output, const ByteLayout& Out, int N )
+{
+ ebmpBYTE Control[16], Fill[16];
+ BuildShuffle( ByteLayouts[BMP_RGBA8], Out, Control, Fill );
+ __m128i ShuffleControl = _mm_loadu_si128( (const __m128i*) Control );
+ __m256 Scale = _mm256_set1_ps( 255.0f );
+ __m256 Zero = _mm256_setzero_ps();
+ __m256 Half = _mm256_set1_ps( 0.5f );
+ int Reach = SafePixels( Out, Out );
+ int i = 0;
+ for( ; i + Reach <= N ; i += 4 )
+ {
+  __m256 First = _mm256_mul_ps( _mm256_loadu_ps( Input + 4*i ), Scale );
+  __m256 Second = _mm256_mul_ps( _mm256_loadu_ps( Input + 4*i + 8 ), Scale );
+  First = _mm256_min_ps( _mm256_max_ps( First, Zero ), Scale );
+  Second = _mm256_min_ps( _mm256_max_ps( Second, Zero ), Scale );
+  __m256i Words = _mm256_packs_epi32( _mm256_cvttps_epi32( _mm256_add_ps( First, Half ) ),
+                                      _mm256_cvttps_epi32( _mm256_add_ps( Second, Half ) ) );
+  // packs works within 128-bit lanes; put the pixels back in order
+  Words = _mm256_permute4x64_epi64( Words, 0xD8 );
+  __m256i Bytes = _mm256_packus_epi16( Words, Words );
+  __m128i Pixels = _mm256_castsi256_si128( _mm256_permute4x64_epi64( Bytes, 0x08 ) );
+  _mm_storeu_si128( (__m128i*) ( Output + i*Out.Size ), _mm_shuffle_epi8( Pixels, ShuffleControl ) );
+ }
+ return i;
+}
+
+ConversionPath DetectPath( void )
+{
+#ifdef _MSC_VER
+ int Info[4];
+ __cpuid( Info, 0 );
+ int Leaves = Info[0];
+ __cpuid( Info, 1 );
+ bool SSSE3 = ( Info[2] & (1<<9) ) != 0;
+ bool OSSavesYMM = ( Info[2] & (1<<27) ) != 0 && ( Info[2] & (1<<28) ) != 0 &&
+                   ( _xgetbv( 0 ) & 6 ) == 6;
+ bool AVX2 = false;
+ if( Leaves >= 7 && OSSavesYMM )
+ {
+  __cpuidex( Info, 7, 0 );
+  AVX2 = ( Info[1] & (1<<5) ) != 0;
+ }
+#else
+ __builtin_cpu_init();
+ bool SSSE3 = __builtin_cpu_supports( "ssse3" ) != 0;
+ bool AVX2 = __builtin_cpu_supports( "avx2" ) != 0;
+#endif
+ if( AVX2 && SSSE3 )
+ { return PathAVX2; }
+ if( SSSE3 )
+ { return PathSSSE3; }
+ return PathScalar;
+}
+
+#else
+
+ConversionPath DetectPath( void )
+{ return PathScalar; }
+
+#endif
+
+ConversionPath TellPath( void )
+{
+ static const ConversionPath Path = DetectPath();
+ return Path;
+}
+
+}
+
+int TellPixelFormatSize( BMPPixelFormat Format )
+{
+ if( Format == BMP_RGBAf32 )
+ { return 4*sizeof(float); }
+ return ByteLayouts[Format].Size;
+}
+
+const char* TellPixelConversionPath( void )
+{
+ switch( TellPath() )
+ {
+  case PathAVX2: return "AVX2";
+  case PathSSSE3: return "SSSE3";
+  default: return "scalar";
+ }
+}
+
+void ConvertPixels( const void* Input, BMPPixelFormat InputFormat,
+                    void* Output, BMPPixelFormat OutputFormat,
+                    int NumberOfPixels )
+{
+ if( NumberOfPixels <= 0 )
+ { return; }
+ if( InputFormat == OutputFormat )
+ {
+  memcpy( Output, Input, (size_t) NumberOfPixels * TellPixelFormatSize( InputFormat ) );
+  return;
+ }
+
+ ConversionPath Path = TellPath();
+ int Done = 0;
+
+ if( OutputFormat == BMP_RGBAf32 )
+ {
+  const ebmpBYTE* In = (const ebmpBYTE*) Input;
+  const ByteLayout& Layout = ByteLayouts[InputFormat];
+  float* Out = (float*) Output;
+#ifdef EasyBMP_CONVERT_SIMD
+  if( Path == PathAVX2 )
+  { Done = BytesToFloatsAVX2( In, Layout, Out, NumberOfPixels ); }
+  else if( Path == PathSSSE3 )
+  { Done = BytesToFloatsSSSE3( In, Layout, Out, NumberOfPixels ); }
+#endif
+  BytesToFloats( In + Done*Layout.Size, Layout, Out + 4*Done, NumberOfPixels - Done );
+  return;
+ }
+
+ if( InputFormat == BMP_RGBAf32 )
+ {
+  const float* In = (const float*) Input;
+  ebmpBYTE* Out = (ebmpBYTE*) Output;
+  const ByteLayout& Layout = ByteLayouts[OutputFormat];
+#ifdef EasyBMP_CONVERT_SIMD
+  if( Path == PathAVX2 )
+  { Done = FloatsToBytesAVX2( In, Out, Layout, NumberOfPixels ); }
+  else if( Path == PathSSSE3 )
+  { Done = FloatsToBytesSSSE3( In, Out, Layout, NumberOfPixels ); }
+#endif
+  FloatsToBytes( In + 4*Done, Out + Done*Layout.Size, Layout, NumberOfPixels - Done );
+  return;
+ }
+
+ const ebmpBYTE* In = (const ebmpBYTE*) Input;
+ ebmpBYTE* Out = (ebmpBYTE*) Output;
+ const ByteLayout& InLayout = ByteLayouts[InputFormat];
+ const ByteLayout& OutLayout = ByteLayouts[OutputFormat];
+#ifdef EasyBMP_CONVERT_SIMD
+ // byte shuffles gain nothing from 256-bit registers
+ if( Path != PathScalar )
+ { Done = BytesToBytesSSSE3( In, InLayout, Out, OutLayout, NumberOfPixels ); }
+#endif
+ BytesToBytes( In + Done*InLayout.Size, InLayout, Out + Done*OutLayout.Size,
+               OutLayout, NumberOfPixels - Done );
+}
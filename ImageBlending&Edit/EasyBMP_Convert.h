@@ -0,0 +1,46 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Convert.h               *
+*                                                *
+* description: Conversions between the pixel     *
+*              formats of files, RGBApixel,      *
+*              displays and float images         *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Convert_h_
+#define _EasyBMP_Convert_h_
+
+// Pixel formats, channels in memory order:
+//
+//   BMP_BGR24    B,G,R bytes (a 24-bit BMP row)
+//   BMP_BGRA32   B,G,R,A bytes (RGBApixel, a 32-bit BMP row)
+//   BMP_RGBA8    R,G,B,A bytes (what most display libraries take)
+//   BMP_RGBAf32  R,G,B,A floats in [0,1]
+
+enum BMPPixelFormat
+{
+ BMP_BGR24,
+ BMP_BGRA32,
+ BMP_RGBA8,
+ BMP_RGBAf32
+};
+
+int TellPixelFormatSize( BMPPixelFormat Format ); // bytes per pixel
+
+// Converts NumberOfPixels pixels of Input into Output; the two must not
+// overlap. A byte b becomes the float b/255, and a float becomes the
+// nearest byte, clamped to [0,255]. A pixel without alpha converts to
+// an opaque one. Uses SSSE3 or AVX2 when the processor has them, with
+// the same results as without.
+
+void ConvertPixels( const void* Input, BMPPixelFormat InputFormat,
+                    void* Output, BMPPixelFormat OutputFormat,
+                    int NumberOfPixels );
+
+// "AVX2", "SSSE3" or "scalar": what ConvertPixels runs on this machine
+const char* TellPixelConversionPath( void );
+
+#endif
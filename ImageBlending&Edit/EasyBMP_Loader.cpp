@@ -0,0 +1,577 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Loader.cpp              *
+*                                                *
+* description: Asynchronous batched loading of   *
+*              many BMP files                    *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Loader.h"
+#include "EasyBMP_Parallel.h"
+
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define EasyBMP_IORING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+// a whole file in memory, or the reason it isn't
+
+struct LoadJob
+{
+ std::string FileName;
+ int Tag;
+ bool NeedsRead;
+ bool ReadOK;
+ std::vector<ebmpBYTE> Data;
+ long long FileSize, ModificationTime; // from the fstat of the open file
+};
+
+// the blocking fallback: open, fstat and positioned reads until the
+// whole file is in Data, with the size and time the fstat gave
+
+bool ReadWholeFile( const char* FileName, std::vector<ebmpBYTE>& Data,
+                    long long& FileSize, long long& ModificationTime )
+{
+#ifdef _WIN32
+ int fd = _open( FileName, _O_RDONLY | _O_BINARY );
+ if( fd < 0 )
+ { return false; }
+ struct _stat64 Status;
+ bool Success = ( _fstat64( fd, &Status ) == 0 && Status.st_size <= INT_MAX );
+ if( Success )
+ {
+  FileSize = (long long) Status.st_size;
+  ModificationTime = (long long) Status.st_mtime;
+  Data.resize( (size_t) Status.st_size );
+  size_t Done = 0;
+  while( Success && Done < Data.size() )
+  {
+   int BytesRead = _read( fd, Data.data() + Done, (unsigned int) ( Data.size() - Done ) );
+   if( BytesRead <= 0 )
+   { Success = false; }
+   else
+   { Done += BytesRead; }
+  }
+ }
+ _close( fd );
+#else
+ int fd = open( FileName, O_RDONLY );
+ if( fd < 0 )
+ { return false; }
+ struct stat Status;
+ bool Success = ( fstat( fd, &Status ) == 0 && Status.st_size <= INT_MAX );
+ if( Success )
+ {
+  FileSize = (long long) Status.st_size;
+  ModificationTime = (long long) Status.st_mtime;
+  Data.resize( (size_t) Status.st_size );
+  size_t Done = 0;
+  while( Success && Done < Data.size() )
+  {
+   ssize_t BytesRead = pread( fd, Data.data() + Done, Data.size() - Done, (off_t) Done );
+   if( BytesRead < 0 && errno == EINTR )
+   { continue; }
+   if( BytesRead <= 0 )
+   { Success = false; }
+   else
+   { Done += (size_t) BytesRead; }
+  }
+ }
+ close( fd );
+#endif
+ return Success;
+}
+
+#ifdef EasyBMP_IORING
+
+// The little of io_uring the loader needs, on the raw system calls so
+// there is no dependency on liburing: queue vectored reads, submit them,
+// and take completions off the ring.
+
+class IORing
+{
+ public:
+ IORing()
+ {
+  Fd = -1;
+  SqPointer = CqPointer = NULL;
+  Sqes = NULL;
+  ToSubmit = 0;
+ }
+ ~IORing()
+ { Close(); }
+
+ bool Open( unsigned Entries )
+ {
+  io_uring_params Parameters;
+  memset( &Parameters, 0, sizeof(Parameters) );
+  Fd = (int) syscall( __NR_io_uring_setup, Entries, &Parameters );
+  if( Fd < 0 )
+  { return false; }
+
+  SqSize = Parameters.sq_off.array + Parameters.sq_entries * sizeof(unsigned);
+  CqSize = Parameters.cq_off.cqes + Parameters.cq_entries * sizeof(io_uring_cqe);
+  bool SingleMap = ( Parameters.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+  if( SingleMap )
+  { SqSize = CqSize = ( SqSize > CqSize ) ? SqSize : CqSize; }
+
+  SqPointer = (char*) mmap( NULL, SqSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING );
+  if( SqPointer == MAP_FAILED )
+  { SqPointer = NULL; Close(); return false; }
+  CqPointer = SqPointer;
+  if( !SingleMap )
+  {
+   CqPointer = (char*) mmap( NULL, CqSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING );
+   if( CqPointer == MAP_FAILED )
+   { CqPointer = NULL; Close(); return false; }
+  }
+  SqeSize = Parameters.sq_entries * sizeof(io_uring_sqe);
+  Sqes = (io_uring_sqe*) mmap( NULL, SqeSize, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES );
+  if( Sqes == MAP_FAILED )
+  { Sqes = NULL; Close(); return false; }
+
+  SqEntries = Parameters.sq_entries;
+  SqHead = (unsigned*) ( SqPointer + Parameters.sq_off.head );
+  SqTail = (unsigned*) ( SqPointer + Parameters.sq_off.tail );
+  SqMask = (unsigned*) ( SqPointer + Parameters.sq_off.ring_mask );
+  SqArray = (unsigned*) ( SqPointer + Parameters.sq_off.array );
+  CqHead = (unsigned*) ( CqPointer + Parameters.cq_off.head );
+  CqTail = (unsigned*) ( CqPointer + Parameters.cq_off.tail );
+  CqMask = (unsigned*) ( CqPointer + Parameters.cq_off.ring_mask );
+  Cqes = (io_uring_cqe*) ( CqPointer + Parameters.cq_off.cqes );
+  return true;
+ }
+
+ void Close( void )
+ {
+  if( Sqes )
+  { munmap( Sqes, SqeSize ); }
+  if( CqPointer && CqPointer != SqPointer )
+  { munmap( CqPointer, CqSize ); }
+  if( SqPointer )
+  { munmap( SqPointer, SqSize ); }
+  if( Fd >= 0 )
+  { close( Fd ); }
+  Fd = -1;
+  SqPointer = CqPointer = NULL;
+  Sqes = NULL;
+ }
+
+ // queues a read of one iovec; the iovec and its buffer must stay put
+ // until the completion for UserData has been reaped
+
+ bool QueueRead( int FileDescriptor, const iovec* Vector, long long Offset,
+                 unsigned long long UserData )
+ {
+  unsigned Tail = *SqTail;
+  if( Tail - __atomic_load_n( SqHead, __ATOMIC_ACQUIRE ) >= SqEntries )
+  { return false; }
+  unsigned Index = Tail & *SqMask;
+  io_uring_sqe* Sqe = &Sqes[Index];
+  memset( Sqe, 0, sizeof(io_uring_sqe) );
+  Sqe->opcode = IORING_OP_READV;
+  Sqe->fd = FileDescriptor;
+  Sqe->addr = (unsigned long long) (size_t) Vector;
+  Sqe->len = 1;
+  Sqe->off = (unsigned long long) Offset;
+  Sqe->user_data = UserData;
+  SqArray[Index] = Index;
+  __atomic_store_n( SqTail, Tail+1, __ATOMIC_RELEASE );
+  ToSubmit++;
+  return true;
+ }
+
+ // submits everything queued and, if MinimumComplete > 0, waits
+ // until that many completions are available
+
+ bool Enter( unsigned MinimumComplete )
+ {
+  for( ;; )
+  {
+   int Submitted = (int) syscall( __NR_io_uring_enter, Fd, ToSubmit, MinimumComplete,
+                                  MinimumComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+   if( Submitted >= 0 )
+   {
+    ToSubmit -= (unsigned) Submitted;
+    return true;
+   }
+   if( errno != EINTR )
+   { return false; }
+  }
+ }
+
+ bool Reap( unsigned long long& UserData, int& Result )
+ {
+  unsigned Head = *CqHead;
+  if( Head == __atomic_load_n( CqTail, __ATOMIC_ACQUIRE ) )
+  { return false; }
+  const io_uring_cqe& Cqe = Cqes[ Head & *CqMask ];
+  UserData = Cqe.user_data;
+  Result = Cqe.res;
+  __atomic_store_n( CqHead, Head+1, __ATOMIC_RELEASE );
+  return true;
+ }
+
+ private:
+ int Fd;
+ char* SqPointer;
+ char* CqPointer;
+ size_t SqSize, CqSize, SqeSize;
+ io_uring_sqe* Sqes;
+ io_uring_cqe* Cqes;
+ unsigned SqEntries;
+ unsigned *SqHead, *SqTail, *SqMask, *SqArray;
+ unsigned *CqHead, *CqTail, *CqMask;
+ unsigned ToSubmit;
+};
+
+#endif
+
+}
+
+struct BMPBatchLoader::Implementation
+{
+ std::mutex Lock;
+ std::condition_variable ReadReady;
+ std::condition_variable DecodeReady;
+ std::condition_variable ResultReady;
+ std::deque<LoadJob> ToRead;
+ std::deque<LoadJob> ToDecode;
+ std::deque<BMPLoadResult> Done;
+ int Pending;
+ bool Stopping;
+ int QueueDepth;
+ bool UseRing;
+
+ std::vector<std::thread> Decoders;
+ std::thread Reader;
+#ifdef EasyBMP_IORING
+ IORing Ring;
+#endif
+
+ void DecodeLoop( void );
+ void ReadLoop( void );
+ void QueueForDecode( LoadJob& Job );
+};
+
+void BMPBatchLoader::Implementation::QueueForDecode( LoadJob& Job )
+{
+ std::lock_guard<std::mutex> Guard( Lock );
+ ToDecode.push_back( std::move( Job ) );
+ DecodeReady.notify_one();
+}
+
+void BMPBatchLoader::Implementation::DecodeLoop( void )
+{
+ using namespace std;
+ for( ;; )
+ {
+  LoadJob Job;
+  {
+   unique_lock<mutex> Guard( Lock );
+   while( !Stopping && ToDecode.empty() )
+   { DecodeReady.wait( Guard ); }
+   if( Stopping )
+   { return; }
+   Job = std::move( ToDecode.front() );
+   ToDecode.pop_front();
+  }
+
+  if( Job.NeedsRead )
+  { Job.ReadOK = ReadWholeFile( Job.FileName.c_str(), Job.Data, Job.FileSize, Job.ModificationTime ); }
+
+  BMPLoadResult Result;
+  Result.FileName = Job.FileName;
+  Result.Tag = Job.Tag;
+  Result.FileSize = Job.FileSize;
+  Result.ModificationTime = Job.ModificationTime;
+  Result.Image.reset( new BMP );
+  if( !Job.ReadOK )
+  {
+   if( EasyBMPwarnings )
+   {
+    cout << "EasyBMP Error: Cannot open file "
+         << Job.FileName << " for input." << endl;
+   }
+   Result.Image->SetBitDepth(1);
+   Result.Image->SetSize(1,1);
+  }
+  else
+  {
+   Result.Success = Result.Image->ReadFromMemory( Job.Data.data(), (int) Job.Data.size() );
+  }
+  // the file buffer goes before the result is published
+  vector<ebmpBYTE>().swap( Job.Data );
+
+  lock_guard<mutex> Guard( Lock );
+  Done.push_back( std::move( Result ) );
+  ResultReady.notify_all();
+ }
+}
+
+#ifdef EasyBMP_IORING
+
+// One thread owns the ring. It keeps up to QueueDepth whole-file reads
+// in flight, re-queues the rest of a file after a short read, and hands
+// each finished buffer to the decode threads.
+
+namespace
+{
+
+struct RingSlot
+{
+ LoadJob Job;
+ int FileDescriptor;
+ size_t BytesDone;
+ iovec Vector;
+ bool Busy;
+};
+
+}
+
+void BMPBatchLoader::Implementation::ReadLoop( void )
+{
+ std::vector<RingSlot> Slots( QueueDepth );
+ for( int n=0 ; n < QueueDepth ; n++ )
+ { Slots[n].Busy = false; Slots[n].FileDescriptor = -1; }
+ int InFlight = 0;
+
+ auto Finish = [&]( int n, bool ReadOK )
+ {
+  RingSlot& Slot = Slots[n];
+  if( Slot.FileDescriptor >= 0 )
+  { close( Slot.FileDescriptor ); }
+  Slot.FileDescriptor = -1;
+  Slot.Job.ReadOK = ReadOK;
+  QueueForDecode( Slot.Job );
+  Slot.Busy = false;
+  InFlight--;
+ };
+ auto QueueRest = [&]( int n )
+ {
+  RingSlot& Slot = Slots[n];
+  Slot.Vector.iov_base = Slot.Job.Data.data() + Slot.BytesDone;
+  Slot.Vector.iov_len = Slot.Job.Data.size() - Slot.BytesDone;
+  if( !Ring.QueueRead( Slot.FileDescriptor, &Slot.Vector,
+                       (long long) Slot.BytesDone, (unsigned long long) n ) )
+  { Finish( n, false ); }
+ };
+
+ for( ;; )
+ {
+  std::vector<int> Started;
+  {
+   std::unique_lock<std::mutex> Guard( Lock );
+   while( !Stopping && ToRead.empty() && InFlight == 0 )
+   { ReadReady.wait( Guard ); }
+   if( Stopping && InFlight == 0 )
+   { return; }
+   // buffers in flight belong to the kernel, so on shutdown the loop
+   // keeps reaping but starts nothing new
+   for( int n=0 ; n < QueueDepth && !Stopping && !ToRead.empty() ; n++ )
+   {
+    if( Slots[n].Busy )
+    { continue; }
+    Slots[n].Job = std::move( ToRead.front() );
+    ToRead.pop_front();
+    Slots[n].Busy = true;
+    InFlight++;
+    Started.push_back( n );
+   }
+  }
+
+  for( size_t k=0 ; k < Started.size() ; k++ )
+  {
+   int n = Started[k];
+   RingSlot& Slot = Slots[n];
+   Slot.BytesDone = 0;
+   Slot.FileDescriptor = open( Slot.Job.FileName.c_str(), O_RDONLY );
+   struct stat Status;
+   if( Slot.FileDescriptor < 0 || fstat( Slot.FileDescriptor, &Status ) != 0 ||
+       Status.st_size > INT_MAX )
+   { Finish( n, false ); continue; }
+   Slot.Job.FileSize = (long long) Status.st_size;
+   Slot.Job.ModificationTime = (long long) Status.st_mtime;
+   Slot.Job.Data.resize( (size_t) Status.st_size );
+   if( Slot.Job.Data.empty() )
+   { Finish( n, true ); continue; }
+   QueueRest( n );
+  }
+  if( InFlight == 0 )
+  { continue; }
+
+  if( !Ring.Enter( 1 ) )
+  {
+   // the ring broke under us: nothing queued can be trusted to
+   // complete, so fail what is in flight rather than hang
+   for( int n=0 ; n < QueueDepth ; n++ )
+   {
+    if( Slots[n].Busy )
+    { Finish( n, false ); }
+   }
+   continue;
+  }
+
+  unsigned long long UserData;
+  int Result;
+  while( Ring.Reap( UserData, Result ) )
+  {
+   int n = (int) UserData;
+   RingSlot& Slot = Slots[n];
+   if( Result == -EINTR || Result == -EAGAIN )
+   { QueueRest( n ); continue; }
+   if( Result <= 0 )
+   {
+    // an error, or the file shrank since fstat
+    Slot.Job.Data.resize( Slot.BytesDone );
+    Finish( n, Result == 0 );
+    continue;
+   }
+   Slot.BytesDone += (size_t) Result;
+   if( Slot.BytesDone < Slot.Job.Data.size() )
+   { QueueRest( n ); }
+   else
+   { Finish( n, true ); }
+  }
+ }
+}
+
+#else
+
+void BMPBatchLoader::Implementation::ReadLoop( void )
+{ }
+
+#endif
+
+BMPLoadResult::BMPLoadResult()
+{
+ Tag = 0;
+ Success = false;
+ FileSize = -1;
+ ModificationTime = -1;
+}
+
+BMPBatchLoader::BMPBatchLoader( int NumberOfThreads, int QueueDepth, bool AllowIORing )
+{
+ Impl = new Implementation;
+ Impl->Pending = 0;
+ Impl->Stopping = false;
+ Impl->QueueDepth = ( QueueDepth < 1 ) ? 1 : QueueDepth;
+ Impl->UseRing = false;
+#ifdef EasyBMP_IORING
+ if( AllowIORing )
+ { Impl->UseRing = Impl->Ring.Open( (unsigned) Impl->QueueDepth ); }
+ if( Impl->UseRing )
+ { Impl->Reader = std::thread( &Implementation::ReadLoop, Impl ); }
+#else
+ (void) AllowIORing;
+#endif
+
+ int Threads = EasyBMPthreadCount( NumberOfThreads );
+ for( int t=0 ; t < Threads ; t++ )
+ { Impl->Decoders.push_back( std::thread( &Implementation::DecodeLoop, Impl ) ); }
+}
+
+BMPBatchLoader::~BMPBatchLoader()
+{
+ {
+  std::lock_guard<std::mutex> Guard( Impl->Lock );
+  Impl->Stopping = true;
+ }
+ Impl->ReadReady.notify_all();
+ Impl->DecodeReady.notify_all();
+ if( Impl->Reader.joinable() )
+ { Impl->Reader.join(); }
+ for( size_t t=0 ; t < Impl->Decoders.size() ; t++ )
+ { Impl->Decoders[t].join(); }
+ delete Impl;
+}
+
+void BMPBatchLoader::Submit( const std::string& FileName, int Tag )
+{
+ LoadJob Job;
+ Job.FileName = FileName;
+ Job.Tag = Tag;
+ Job.NeedsRead = !Impl->UseRing;
+ Job.ReadOK = false;
+ Job.FileSize = -1;
+ Job.ModificationTime = -1;
+
+ std::lock_guard<std::mutex> Guard( Impl->Lock );
+ Impl->Pending++;
+ if( Impl->UseRing )
+ {
+  Impl->ToRead.push_back( std::move( Job ) );
+  Impl->ReadReady.notify_one();
+ }
+ else
+ {
+  Impl->ToDecode.push_back( std::move( Job ) );
+  Impl->DecodeReady.notify_one();
+ }
+}
+
+bool BMPBatchLoader::WaitNext( BMPLoadResult& Result )
+{
+ std::unique_lock<std::mutex> Guard( Impl->Lock );
+ if( Impl->Pending == 0 )
+ { return false; }
+ while( Impl->Done.empty() )
+ { Impl->ResultReady.wait( Guard ); }
+ Result = std::move( Impl->Done.front() );
+ Impl->Done.pop_front();
+ Impl->Pending--;
+ return true;
+}
+
+bool BMPBatchLoader::TryNext( BMPLoadResult& Result )
+{
+ std::lock_guard<std::mutex> Guard( Impl->Lock );
+ if( Impl->Done.empty() )
+ { return false; }
+ Result = std::move( Impl->Done.front() );
+ Impl->Done.pop_front();
+ Impl->Pending--;
+ return true;
+}
+
+int BMPBatchLoader::TellPending( void )
+{
+ std::lock_guard<std::mutex> Guard( Impl->Lock );
+ return Impl->Pending;
+}
+
+bool BMPBatchLoader::UsingIORing( void ) const
+{ return Impl->UseRing; }
@@ -0,0 +1,65 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Loader.h                *
+*                                                *
+* description: Asynchronous batched loading of   *
+*              many BMP files                    *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Loader_h_
+#define _EasyBMP_Loader_h_
+
+#include <memory>
+#include <string>
+
+// One finished load. Tag is whatever the caller passed to Submit, so
+// results can be matched up even though they arrive in completion order.
+
+struct BMPLoadResult
+{
+ std::string FileName;
+ int Tag;
+ bool Success;
+ std::unique_ptr<BMP> Image;
+ // of the file as it was opened, before it was read; -1 if it could
+ // not be opened
+ long long FileSize, ModificationTime;
+
+ BMPLoadResult();
+};
+
+// Loads BMP files in the background. Whole files are read with io_uring
+// where the kernel offers it (Linux), QueueDepth reads in flight at a
+// time; everywhere else, or if the ring can't be set up, the decode
+// threads read the files themselves with plain positioned reads. Either
+// way NumberOfThreads threads (<= 0: one per core) decode the buffers
+// with BMP::ReadFromMemory and push the results onto a completion queue.
+
+class BMPBatchLoader
+{
+ public:
+ BMPBatchLoader( int NumberOfThreads = 0, int QueueDepth = 32, bool AllowIORing = true );
+ ~BMPBatchLoader();
+
+ void Submit( const std::string& FileName, int Tag );
+
+ // WaitNext blocks until a load completes; TryNext only takes one that
+ // already has. Both return false if there is nothing to return.
+ bool WaitNext( BMPLoadResult& Result );
+ bool TryNext( BMPLoadResult& Result );
+
+ int TellPending( void );
+ bool UsingIORing( void ) const;
+
+ private:
+ struct Implementation;
+ BMPBatchLoader( const BMPBatchLoader& );
+ BMPBatchLoader& operator=( const BMPBatchLoader& );
+
+ Implementation* Impl;
+};
+
+#endif
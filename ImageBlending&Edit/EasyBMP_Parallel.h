@@ -0,0 +1,68 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Parallel.h              *
+*                                                *
+* description: Small helpers for splitting work  *
+*              across std::threads               *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Parallel_h_
+#define _EasyBMP_Parallel_h_
+
+#include <thread>
+#include <vector>
+
+// returns the number of threads to use when the caller asks for
+// "as many as make sense" (NumberOfThreads <= 0)
+
+inline int EasyBMPthreadCount( int NumberOfThreads )
+{
+ if( NumberOfThreads > 0 )
+ { return NumberOfThreads; }
+ int Hardware = (int) std::thread::hardware_concurrency();
+ if( Hardware < 1 )
+ { Hardware = 1; }
+ return Hardware;
+}
+
+// splits [Begin,End) into one contiguous block per thread, but none
+// shorter than MinimumBlock, and calls Body( BlockBegin, BlockEnd ) for
+// each block. The last block runs on the calling thread, so a
+// single-threaded call spawns nothing.
+
+template <class Function>
+void EasyBMPparallelFor( int Begin, int End, int NumberOfThreads, int MinimumBlock, Function Body )
+{
+ int Count = End - Begin;
+ if( Count <= 0 )
+ { return; }
+ int Threads = EasyBMPthreadCount( NumberOfThreads );
+ if( MinimumBlock < 1 )
+ { MinimumBlock = 1; }
+ if( Threads > Count / MinimumBlock )
+ { Threads = Count / MinimumBlock; }
+ if( Threads < 1 )
+ { Threads = 1; }
+
+ std::vector<std::thread> Workers;
+ Workers.reserve( Threads-1 );
+ int Start = Begin;
+ for( int t=0 ; t < Threads-1 ; t++ )
+ {
+  int Stop = Begin + (int) ( ( (long long) Count * (t+1) ) / Threads );
+  Workers.push_back( std::thread( Body, Start, Stop ) );
+  Start = Stop;
+ }
+ Body( Start, End );
+ for( size_t t=0 ; t < Workers.size() ; t++ )
+ { Workers[t].join(); }
+}
+
+template <class Function>
+void EasyBMPparallelFor( int Begin, int End, int NumberOfThreads, Function Body )
+{ EasyBMPparallelFor( Begin, End, NumberOfThreads, 1, Body ); }
+
+#endif
@@ -0,0 +1,277 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Probe.cpp               *
+*                                                *
+* description: Header-only probing of BMP files  *
+*              and a persistent metadata index   *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Probe.h"
+#include "EasyBMP_Parallel.h"
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+// one open, one fstat and one read of the first Size bytes
+
+int ReadFileHead( const char* FileName, ebmpBYTE* Data, int Size,
+                  long long& FileSize, long long& ModificationTime )
+{
+#ifdef _WIN32
+ int fd = _open( FileName, _O_RDONLY | _O_BINARY );
+ if( fd < 0 )
+ { return -1; }
+ struct _stat64 Status;
+ int BytesRead = -1;
+ if( _fstat64( fd, &Status ) == 0 )
+ { BytesRead = _read( fd, Data, Size ); }
+ _close( fd );
+#else
+ int fd = open( FileName, O_RDONLY );
+ if( fd < 0 )
+ { return -1; }
+ struct stat Status;
+ int BytesRead = -1;
+ if( fstat( fd, &Status ) == 0 )
+ { BytesRead = (int) pread( fd, Data, Size, 0 ); }
+ close( fd );
+#endif
+ if( BytesRead >= 0 )
+ {
+  FileSize = (long long) Status.st_size;
+  ModificationTime = (long long) Status.st_mtime;
+ }
+ return BytesRead;
+}
+
+}
+
+bool StatBMPFile( const char* FileName, long long& FileSize, long long& ModificationTime )
+{
+#ifdef _WIN32
+ struct _stat64 Status;
+ if( _stat64( FileName, &Status ) != 0 )
+ { return false; }
+#else
+ struct stat Status;
+ if( stat( FileName, &Status ) != 0 )
+ { return false; }
+#endif
+ FileSize = (long long) Status.st_size;
+ ModificationTime = (long long) Status.st_mtime;
+ return true;
+}
+
+std::string TemporaryName( const std::string& Destination )
+{
+ static std::atomic<unsigned> Counter( 0 );
+#ifdef _WIN32
+ int Process = _getpid();
+#else
+ int Process = (int) getpid();
+#endif
+ std::ostringstream Name;
+ Name << Destination << ".tmp" << Process << "." << Counter++;
+ return Name.str();
+}
+
+BMPProbe::BMPProbe()
+{
+ Valid = false;
+ FileSize = 0;
+ ModificationTime = 0;
+ Width = 0;
+ Height = 0;
+ TopDown = false;
+ BitDepth = 0;
+ Compression = 0;
+ DataOffset = 0;
+}
+
+bool ProbeBMP( const char* FileName, BMPProbe& Probe )
+{
+ using namespace std;
+ Probe = BMPProbe();
+ Probe.FileName = FileName;
+
+ ebmpBYTE Data[54];
+ int BytesRead = ReadFileHead( FileName, Data, 54, Probe.FileSize, Probe.ModificationTime );
+ if( BytesRead < 0 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Cannot open file "
+        << FileName << " for input." << endl;
+  }
+  return false;
+ }
+
+ BMFH bmfh;
+ BMIH bmih;
+ if( !ParseBMPHeaders( Data, BytesRead, bmfh, bmih ) ||
+     bmfh.bfType != 19778 || bmih.biSize < 40 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName
+        << " is not a Windows BMP file!" << endl;
+  }
+  return false;
+ }
+
+ int Height = (int) bmih.biHeight;
+ Probe.Width = (int) bmih.biWidth;
+ Probe.TopDown = ( Height < 0 );
+ Probe.Height = Probe.TopDown ? -Height : Height;
+ Probe.BitDepth = (int) bmih.biBitCount;
+ Probe.Compression = (int) bmih.biCompression;
+ Probe.DataOffset = (int) bmfh.bfOffBits;
+ Probe.Valid = ( Probe.Width > 0 && Probe.Height > 0 );
+ return Probe.Valid;
+}
+
+std::vector<BMPProbe> ProbeBMPs( const std::vector<std::string>& FileNames,
+                                 int NumberOfThreads )
+{
+ std::vector<BMPProbe> Probes( FileNames.size() );
+ EasyBMPparallelFor( 0, (int) FileNames.size(), NumberOfThreads,
+  [&]( int Begin, int End )
+  {
+   for( int n=Begin ; n < End ; n++ )
+   { ProbeBMP( FileNames[n].c_str(), Probes[n] ); }
+  } );
+ return Probes;
+}
+
+bool BMPProbeIndex::Load( const char* IndexFileName )
+{
+ std::ifstream Input( IndexFileName );
+ if( !Input )
+ { return false; }
+
+ // FileName is last on the line so it may contain spaces
+ std::string Line;
+ while( std::getline( Input, Line ) )
+ {
+  std::istringstream Fields( Line );
+  BMPProbe Probe;
+  int TopDown = 0;
+  Fields >> Probe.FileSize >> Probe.ModificationTime
+         >> Probe.Width >> Probe.Height >> TopDown
+         >> Probe.BitDepth >> Probe.Compression >> Probe.DataOffset;
+  if( !Fields )
+  { continue; }
+  Fields.get();
+  std::getline( Fields, Probe.FileName );
+  if( Probe.FileName.empty() )
+  { continue; }
+  Probe.TopDown = ( TopDown != 0 );
+  Probe.Valid = true;
+  Entries[Probe.FileName] = Probe;
+ }
+ return true;
+}
+
+bool BMPProbeIndex::Save( const char* IndexFileName ) const
+{
+ // write a sibling file and move it into place, so a crash never
+ // leaves a truncated index behind
+ std::string TempName = TemporaryName( IndexFileName );
+ {
+  std::ofstream Output( TempName.c_str() );
+  if( !Output )
+  { return false; }
+  for( std::unordered_map<std::string,BMPProbe>::const_iterator it = Entries.begin() ;
+       it != Entries.end() ; ++it )
+  {
+   const BMPProbe& Probe = it->second;
+   if( !Probe.Valid )
+   { continue; }
+   Output << Probe.FileSize << ' ' << Probe.ModificationTime << ' '
+          << Probe.Width << ' ' << Probe.Height << ' ' << (int) Probe.TopDown << ' '
+          << Probe.BitDepth << ' ' << Probe.Compression << ' ' << Probe.DataOffset << ' '
+          << Probe.FileName << '\n';
+  }
+  if( !Output )
+  {
+   Output.close();
+   std::remove( TempName.c_str() );
+   return false;
+  }
+ }
+ if( std::rename( TempName.c_str(), IndexFileName ) == 0 )
+ { return true; }
+ // rename does not replace on every platform
+ std::remove( IndexFileName );
+ if( std::rename( TempName.c_str(), IndexFileName ) == 0 )
+ { return true; }
+ std::remove( TempName.c_str() );
+ return false;
+}
+
+BMPProbe BMPProbeIndex::Lookup( const std::string& FileName )
+{
+ std::vector<std::string> FileNames( 1, FileName );
+ return LookupAll( FileNames, 1 )[0];
+}
+
+std::vector<BMPProbe> BMPProbeIndex::LookupAll( const std::vector<std::string>& FileNames,
+                                                int NumberOfThreads )
+{
+ // the workers only read Entries; fresh probes are merged afterwards
+ std::vector<BMPProbe> Probes( FileNames.size() );
+ std::vector<char> Fresh( FileNames.size(), 0 );
+ EasyBMPparallelFor( 0, (int) FileNames.size(), NumberOfThreads,
+  [&]( int Begin, int End )
+  {
+   for( int n=Begin ; n < End ; n++ )
+   {
+    std::unordered_map<std::string,BMPProbe>::const_iterator it = Entries.find( FileNames[n] );
+    long long FileSize, ModificationTime;
+    if( it != Entries.end() &&
+        StatBMPFile( FileNames[n].c_str(), FileSize, ModificationTime ) &&
+        FileSize == it->second.FileSize &&
+        ModificationTime == it->second.ModificationTime )
+    {
+     Probes[n] = it->second;
+     continue;
+    }
+    ProbeBMP( FileNames[n].c_str(), Probes[n] );
+    Fresh[n] = 1;
+   }
+  } );
+
+ for( size_t n=0 ; n < FileNames.size() ; n++ )
+ {
+  if( !Fresh[n] )
+  { continue; }
+  if( Probes[n].Valid )
+  { Entries[FileNames[n]] = Probes[n]; }
+  else
+  { Entries.erase( FileNames[n] ); }
+ }
+ return Probes;
+}
+
+int BMPProbeIndex::TellNumberOfEntries( void ) const
+{ return (int) Entries.size(); }
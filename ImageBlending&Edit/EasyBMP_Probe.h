@@ -0,0 +1,81 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Probe.h                 *
+*                                                *
+* description: Header-only probing of BMP files  *
+*              and a persistent metadata index   *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Probe_h_
+#define _EasyBMP_Probe_h_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// What a job planner needs to know about a BMP without decoding it.
+// Height is always positive; TopDown records a negative biHeight.
+
+struct BMPProbe
+{
+ std::string FileName;
+ bool Valid;
+ long long FileSize;
+ long long ModificationTime;
+ int Width;
+ int Height;
+ bool TopDown;
+ int BitDepth;
+ int Compression;
+ int DataOffset;
+
+ BMPProbe();
+};
+
+// Size and modification time of a path without opening it; false if
+// the file does not exist. This is what cached entries are checked against.
+
+bool StatBMPFile( const char* FileName, long long& FileSize, long long& ModificationTime );
+
+// A temporary name next to Destination that no other thread or process
+// will pick at the same time, for writing a file before renaming it
+// into place.
+
+std::string TemporaryName( const std::string& Destination );
+
+// Opens FileName once, takes size and modification time from the open
+// handle and reads the 54 header bytes with a single positioned read.
+// Returns Probe.Valid.
+
+bool ProbeBMP( const char* FileName, BMPProbe& Probe );
+
+// Probes every file, NumberOfThreads at a time (<= 0: one per core).
+// The result is in the same order as FileNames.
+
+std::vector<BMPProbe> ProbeBMPs( const std::vector<std::string>& FileNames,
+                                 int NumberOfThreads );
+
+// An on-disk index of probes keyed by path. An entry is reused only
+// while the file's size and modification time still match; anything
+// else is probed again. The index file is plain text, one file per line.
+
+class BMPProbeIndex
+{
+ public:
+ bool Load( const char* IndexFileName );
+ bool Save( const char* IndexFileName ) const;
+
+ BMPProbe Lookup( const std::string& FileName );
+ std::vector<BMPProbe> LookupAll( const std::vector<std::string>& FileNames,
+                                  int NumberOfThreads );
+
+ int TellNumberOfEntries( void ) const;
+
+ private:
+ std::unordered_map<std::string,BMPProbe> Entries;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Quantize.cpp            *
+*                                                *
+* description: Adaptive color tables and         *
+*              parallel error diffusion          *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Quantize.h"
+#include "EasyBMP_Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+// a histogram bin holds everything median cut needs: the 5-bit
+// coordinates of the bin, how many samples fell into it and the
+// sums of their full-precision channels (for the box averages)
+
+struct HistogramBin
+{
+ int Coordinate[3];
+ unsigned long long Count;
+ unsigned long long Sum[3];
+};
+
+struct ColorBox
+{
+ int Begin;
+ int End;
+ unsigned long long Count;
+ int LongestAxis;
+ int LongestRange;
+};
+
+const int HistogramBits = 5;
+const int HistogramSize = 1 << (3*HistogramBits);
+
+inline int HistogramIndex( const RGBApixel& Pixel )
+{
+ return ( (Pixel.Red   >> (8-HistogramBits)) << (2*HistogramBits) )
+      | ( (Pixel.Green >> (8-HistogramBits)) << HistogramBits )
+      |   (Pixel.Blue  >> (8-HistogramBits));
+}
+
+void MeasureBox( std::vector<HistogramBin>& Bins, ColorBox& Box )
+{
+ int Low[3] = { 255, 255, 255 };
+ int High[3] = { 0, 0, 0 };
+ Box.Count = 0;
+ for( int n=Box.Begin ; n < Box.End ; n++ )
+ {
+  for( int c=0 ; c < 3 ; c++ )
+  {
+   Low[c] = std::min( Low[c], Bins[n].Coordinate[c] );
+   High[c] = std::max( High[c], Bins[n].Coordinate[c] );
+  }
+  Box.Count += Bins[n].Count;
+ }
+ Box.LongestAxis = 0;
+ Box.LongestRange = High[0] - Low[0];
+ for( int c=1 ; c < 3 ; c++ )
+ {
+  if( High[c] - Low[c] > Box.LongestRange )
+  { Box.LongestAxis = c; Box.LongestRange = High[c] - Low[c]; }
+ }
+}
+
+// nearest palette entry by squared RGB distance
+
+int NearestColor( const RGBApixel* Palette, int NumberOfColors, int Red, int Green, int Blue )
+{
+ int BestI = 0;
+ int BestMatch = 1 << 30;
+ for( int n=0 ; n < NumberOfColors ; n++ )
+ {
+  int TempMatch = IntSquare( Palette[n].Red - Red )
+                + IntSquare( Palette[n].Green - Green )
+                + IntSquare( Palette[n].Blue - Blue );
+  if( TempMatch < BestMatch )
+  { BestI = n; BestMatch = TempMatch; }
+ }
+ return BestI;
+}
+
+// Inverse color map at 6 bits per channel, filled lazily from the
+// cell centers. Filling is idempotent, so concurrent writers are
+// harmless and the result does not depend on the thread schedule.
+
+class InverseColorMap
+{
+ public:
+ InverseColorMap( const RGBApixel* Palette, int NumberOfColors )
+  : Palette( Palette ), NumberOfColors( NumberOfColors ),
+    Cells( new std::atomic<short> [CellCount] )
+ {
+  for( int n=0 ; n < CellCount ; n++ )
+  { Cells[n].store( -1, std::memory_order_relaxed ); }
+ }
+
+ int Lookup( int Red, int Green, int Blue )
+ {
+  int Cell = ( (Red >> 2) << 12 ) | ( (Green >> 2) << 6 ) | (Blue >> 2);
+  int Index = Cells[Cell].load( std::memory_order_relaxed );
+  if( Index < 0 )
+  {
+   Index = NearestColor( Palette, NumberOfColors,
+                         (Red & ~3) + 2, (Green & ~3) + 2, (Blue & ~3) + 2 );
+   Cells[Cell].store( (short) Index, std::memory_order_relaxed );
+  }
+  return Index;
+ }
+
+ private:
+ static const int CellCount = 1 << 18;
+ const RGBApixel* Palette;
+ int NumberOfColors;
+ std::unique_ptr< std::atomic<short>[] > Cells;
+};
+
+inline int ClampChannel( int Value )
+{
+ if( Value < 0 )
+ { return 0; }
+ if( Value > 255 )
+ { return 255; }
+ return Value;
+}
+
+}
+
+bool CreateOptimizedColorTable( BMP& InputImage, int NewDepth )
+{
+ using namespace std;
+ if( NewDepth != 1 && NewDepth != 4 && NewDepth != 8 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Warning: Attempted to create an optimized color table" << endl
+        << "                 at bit depth " << NewDepth << ", which does not use" << endl
+        << "                 a color table. Ignoring request." << endl;
+  }
+  return false;
+ }
+
+ int Width = InputImage.TellWidth();
+ int Height = InputImage.TellHeight();
+
+ // sample on a regular grid so that large images cost no more
+ // than about a quarter million histogram updates
+
+ int SampleStep = 1;
+ while( (long long) (Width/SampleStep) * (Height/SampleStep) > 262144 )
+ { SampleStep++; }
+ int SampleRows = (Height + SampleStep - 1) / SampleStep;
+
+ // one private histogram per thread, merged afterwards; small
+ // images are not worth the extra memory
+
+ int Threads = EasyBMPthreadCount( 0 );
+ long long Samples = (long long) SampleRows * ( (Width + SampleStep - 1) / SampleStep );
+ if( Threads > (int) ( Samples / 65536 ) + 1 )
+ { Threads = (int) ( Samples / 65536 ) + 1; }
+ if( Threads > SampleRows )
+ { Threads = SampleRows; }
+
+ std::vector< std::vector<HistogramBin> > Partial( Threads );
+ std::atomic<int> NextPartial( 0 );
+ EasyBMPparallelFor( 0, SampleRows, Threads,
+  [&]( int RowBegin, int RowEnd )
+  {
+   std::vector<HistogramBin>& Histogram = Partial[ NextPartial++ ];
+   Histogram.assign( HistogramSize, HistogramBin() );
+   for( int r=RowBegin ; r < RowEnd ; r++ )
+   {
+    int j = r*SampleStep;
+    for( int i=0 ; i < Width ; i += SampleStep )
+    {
+     RGBApixel Pixel = InputImage.GetPixel( i, j );
+     HistogramBin& Bin = Histogram[ HistogramIndex( Pixel ) ];
+     Bin.Count++;
+     Bin.Sum[0] += Pixel.Red;
+     Bin.Sum[1] += Pixel.Green;
+     Bin.Sum[2] += Pixel.Blue;
+    }
+   }
+  } );
+
+ std::vector<HistogramBin> Bins;
+ for( int n=0 ; n < HistogramSize ; n++ )
+ {
+  HistogramBin Merged = HistogramBin();
+  for( int t=0 ; t < Threads ; t++ )
+  {
+   const HistogramBin& Bin = Partial[t][n];
+   Merged.Count += Bin.Count;
+   for( int c=0 ; c < 3 ; c++ )
+   { Merged.Sum[c] += Bin.Sum[c]; }
+  }
+  if( Merged.Count )
+  {
+   Merged.Coordinate[0] = (n >> (2*HistogramBits)) & ((1<<HistogramBits)-1);
+   Merged.Coordinate[1] = (n >> HistogramBits) & ((1<<HistogramBits)-1);
+   Merged.Coordinate[2] = n & ((1<<HistogramBits)-1);
+   Bins.push_back( Merged );
+  }
+ }
+ Partial.clear();
+
+ // median cut: keep splitting the box with the most samples times
+ // extent until the table is full or nothing is left to split
+
+ int NumberOfColors = IntPow( 2, NewDepth );
+ std::vector<ColorBox> Boxes;
+ ColorBox First;
+ First.Begin = 0;
+ First.End = (int) Bins.size();
+ MeasureBox( Bins, First );
+ Boxes.push_back( First );
+
+ while( (int) Boxes.size() < NumberOfColors )
+ {
+  int Best = -1;
+  unsigned long long BestScore = 0;
+  for( size_t b=0 ; b < Boxes.size() ; b++ )
+  {
+   if( Boxes[b].End - Boxes[b].Begin < 2 )
+   { continue; }
+   unsigned long long Score = Boxes[b].Count * (Boxes[b].LongestRange + 1);
+   if( Best < 0 || Score > BestScore )
+   { Best = (int) b; BestScore = Score; }
+  }
+  if( Best < 0 )
+  { break; }
+
+  ColorBox& Box = Boxes[Best];
+  int Axis = Box.LongestAxis;
+  std::sort( Bins.begin() + Box.Begin, Bins.begin() + Box.End,
+   [Axis]( const HistogramBin& A, const HistogramBin& B )
+   { return A.Coordinate[Axis] < B.Coordinate[Axis]; } );
+
+  unsigned long long Half = Box.Count / 2;
+  unsigned long long Running = 0;
+  int Split = Box.Begin + 1;
+  for( int n=Box.Begin ; n < Box.End - 1 ; n++ )
+  {
+   Running += Bins[n].Count;
+   Split = n + 1;
+   if( Running >= Half )
+   { break; }
+  }
+
+  ColorBox Upper;
+  Upper.Begin = Split;
+  Upper.End = Box.End;
+  Box.End = Split;
+  MeasureBox( Bins, Box );
+  MeasureBox( Bins, Upper );
+  Boxes.push_back( Upper );
+ }
+
+ InputImage.SetBitDepth( NewDepth );
+
+ for( int n=0 ; n < NumberOfColors ; n++ )
+ {
+  RGBApixel TempColor;
+  TempColor.Red = 0;
+  TempColor.Green = 0;
+  TempColor.Blue = 0;
+  TempColor.Alpha = 0;
+  if( n < (int) Boxes.size() && Boxes[n].Count )
+  {
+   unsigned long long Sum[3] = { 0, 0, 0 };
+   for( int k=Boxes[n].Begin ; k < Boxes[n].End ; k++ )
+   {
+    for( int c=0 ; c < 3 ; c++ )
+    { Sum[c] += Bins[k].Sum[c]; }
+   }
+   unsigned long long Count = Boxes[n].Count;
+   TempColor.Red   = (ebmpBYTE) ( (Sum[0] + Count/2) / Count );
+   TempColor.Green = (ebmpBYTE) ( (Sum[1] + Count/2) / Count );
+   TempColor.Blue  = (ebmpBYTE) ( (Sum[2] + Count/2) / Count );
+  }
+  InputImage.SetColor( n, TempColor );
+ }
+ return true;
+}
+
+bool DitherToColorTable( BMP& InputImage, int NumberOfThreads )
+{
+ using namespace std;
+ int BitDepth = InputImage.TellBitDepth();
+ if( BitDepth != 1 && BitDepth != 4 && BitDepth != 8 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Warning: Attempted to dither to a color table at a bit" << endl
+        << "                 depth that does not use a color table." << endl
+        << "                 Ignoring request." << endl;
+  }
+  return false;
+ }
+
+ int Width = InputImage.TellWidth();
+ int Height = InputImage.TellHeight();
+ int NumberOfColors = InputImage.TellNumberOfColors();
+
+ std::vector<RGBApixel> Palette( NumberOfColors );
+ for( int n=0 ; n < NumberOfColors ; n++ )
+ { Palette[n] = InputImage.GetColor( n ); }
+ InverseColorMap Inverse( &Palette[0], NumberOfColors );
+
+ // working copy in 1/16 units so the 7/16, 3/16, 5/16, 1/16
+ // weights are exact integers; row j+1 receives its error while
+ // row j is still being processed
+
+ std::vector<int> Work( (size_t) Width * Height * 3 );
+ EasyBMPparallelFor( 0, Height, NumberOfThreads,
+  [&]( int RowBegin, int RowEnd )
+  {
+   for( int j=RowBegin ; j < RowEnd ; j++ )
+   {
+    int* Row = &Work[ (size_t) j * Width * 3 ];
+    for( int i=0 ; i < Width ; i++ )
+    {
+     RGBApixel Pixel = InputImage.GetPixel( i, j );
+     Row[3*i]   = 16*Pixel.Red;
+     Row[3*i+1] = 16*Pixel.Green;
+     Row[3*i+2] = 16*Pixel.Blue;
+    }
+   }
+  } );
+
+ // Progress[j] is the number of finished pixels in row j. A row may
+ // handle pixel i once the row above has finished pixel i+2, the last
+ // one to push error onto (i+1,j) which pixel i also updates. Rows are
+ // dealt out round-robin so neighbouring rows run on different threads.
+
+ const int Publish = 32;
+ std::unique_ptr< std::atomic<int>[] > Progress( new std::atomic<int> [Height] );
+ for( int j=0 ; j < Height ; j++ )
+ { Progress[j].store( 0, std::memory_order_relaxed ); }
+
+ int Threads = EasyBMPthreadCount( NumberOfThreads );
+ if( Threads > Height )
+ { Threads = Height; }
+
+ auto DitherRows = [&]( int FirstRow )
+ {
+  for( int j=FirstRow ; j < Height ; j += Threads )
+  {
+   int* Row = &Work[ (size_t) j * Width * 3 ];
+   int* Below = ( j+1 < Height ) ? Row + (size_t) Width * 3 : NULL;
+   int Ready = ( j == 0 ) ? Width : 0;
+
+   for( int i=0 ; i < Width ; i++ )
+   {
+    int Needed = std::min( i+3, Width );
+    while( Ready < Needed )
+    {
+     Ready = Progress[j-1].load( std::memory_order_acquire );
+     if( Ready < Needed )
+     { std::this_thread::yield(); }
+    }
+
+    int Value[3];
+    for( int c=0 ; c < 3 ; c++ )
+    { Value[c] = ClampChannel( ( Row[3*i+c] + 8 ) >> 4 ); }
+    int Index = Inverse.Lookup( Value[0], Value[1], Value[2] );
+    const RGBApixel& Chosen = Palette[Index];
+
+    int Error[3];
+    Error[0] = Row[3*i]   - 16*Chosen.Red;
+    Error[1] = Row[3*i+1] - 16*Chosen.Green;
+    Error[2] = Row[3*i+2] - 16*Chosen.Blue;
+    for( int c=0 ; c < 3 ; c++ )
+    {
+     // keep runaway error from saturating flat regions
+     Error[c] = std::max( -16*255, std::min( 16*255, Error[c] ) );
+     if( i+1 < Width )
+     { Row[3*(i+1)+c] += (Error[c]*7) / 16; }
+     if( Below )
+     {
+      if( i > 0 )
+      { Below[3*(i-1)+c] += (Error[c]*3) / 16; }
+      Below[3*i+c] += (Error[c]*5) / 16;
+      if( i+1 < Width )
+      { Below[3*(i+1)+c] += Error[c] / 16; }
+     }
+    }
+
+    RGBApixel* Target = InputImage(i,j);
+    Target->Red = Chosen.Red;
+    Target->Green = Chosen.Green;
+    Target->Blue = Chosen.Blue;
+
+    if( (i+1) % Publish == 0 )
+    { Progress[j].store( i+1, std::memory_order_release ); }
+   }
+   Progress[j].store( Width, std::memory_order_release );
+  }
+ };
+
+ std::vector<std::thread> Workers;
+ for( int t=1 ; t < Threads ; t++ )
+ { Workers.push_back( std::thread( DitherRows, t ) ); }
+ DitherRows( 0 );
+ for( size_t t=0 ; t < Workers.size() ; t++ )
+ { Workers[t].join(); }
+
+ return true;
+}
+
+bool QuantizeImage( BMP& InputImage, int NewDepth, int NumberOfThreads )
+{
+ if( !CreateOptimizedColorTable( InputImage, NewDepth ) )
+ { return false; }
+ return DitherToColorTable( InputImage, NumberOfThreads );
+}
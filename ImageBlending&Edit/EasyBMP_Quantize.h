@@ -0,0 +1,34 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Quantize.h              *
+*                                                *
+* description: Adaptive (median-cut) color       *
+*              tables and parallel error         *
+*              diffusion for 1, 4 and 8-bit      *
+*              output                            *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Quantize_h_
+#define _EasyBMP_Quantize_h_
+
+// Sets the bit depth of InputImage to NewDepth (1, 4 or 8) and replaces
+// the standard color table with one built by median cut over a sampled
+// 15-bit histogram of the image. The pixels themselves are unchanged.
+
+bool CreateOptimizedColorTable( BMP& InputImage, int NewDepth );
+
+// Floyd-Steinberg dithers InputImage onto its current color table, so
+// every pixel afterwards is an exact palette entry. Rows are dealt out
+// to NumberOfThreads threads (<= 0 means one per core) and run as a
+// wavefront: each row trails the one above it by three pixels.
+
+bool DitherToColorTable( BMP& InputImage, int NumberOfThreads );
+
+// Convenience wrapper: optimized table followed by dithering.
+
+bool QuantizeImage( BMP& InputImage, int NewDepth, int NumberOfThreads );
+
+#endif
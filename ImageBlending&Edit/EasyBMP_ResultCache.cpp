@@ -0,0 +1,412 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_ResultCache.cpp         *
+*                                                *
+* description: A content-addressed on-disk cache *
+*              of finished output files          *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_ResultCache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+const unsigned long long FNVPrime = 0x100000001b3ULL;
+const unsigned long long GoldenRatio = 0x9E3779B97F4A7C15ULL;
+
+unsigned long long FinalMix( unsigned long long Value )
+{
+ Value ^= Value >> 33;
+ Value *= 0xff51afd7ed558ccdULL;
+ Value ^= Value >> 33;
+ Value *= 0xc4ceb9fe1a85ec53ULL;
+ Value ^= Value >> 33;
+ return Value;
+}
+
+struct CacheFile
+{
+ std::string Path;
+ long long Size;
+ long long ModificationTime;
+};
+
+// the finished outputs in Directory, i.e. files named <32 hex digits>.bmp
+
+void ListEntries( const std::string& Directory, std::vector<CacheFile>& Files )
+{
+ Files.clear();
+#ifdef _WIN32
+ std::string Pattern = Directory + "/*.bmp";
+ struct _finddata64_t Found;
+ intptr_t Handle = _findfirst64( Pattern.c_str(), &Found );
+ if( Handle == -1 )
+ { return; }
+ do
+ {
+  std::string Name = Found.name;
+  if( Name.size() != 36 || ( Found.attrib & _A_SUBDIR ) )
+  { continue; }
+  CacheFile File;
+  File.Path = Directory + "/" + Name;
+  File.Size = (long long) Found.size;
+  File.ModificationTime = (long long) Found.time_write;
+  Files.push_back( File );
+ }
+ while( _findnext64( Handle, &Found ) == 0 );
+ _findclose( Handle );
+#else
+ DIR* Listing = opendir( Directory.c_str() );
+ if( !Listing )
+ { return; }
+ while( struct dirent* Found = readdir( Listing ) )
+ {
+  std::string Name = Found->d_name;
+  if( Name.size() != 36 || Name.compare( 32, 4, ".bmp" ) != 0 )
+  { continue; }
+  CacheFile File;
+  File.Path = Directory + "/" + Name;
+  if( !StatBMPFile( File.Path.c_str(), File.Size, File.ModificationTime ) )
+  { continue; }
+  Files.push_back( File );
+ }
+ closedir( Listing );
+#endif
+}
+
+// copies Source to a temporary file and renames it into place; with
+// Replace false an existing Destination wins (it has the same content)
+
+bool CopyFileAtomically( const char* Source, const std::string& Destination, bool Replace )
+{
+ FILE* Input = fopen( Source, "rb" );
+ if( !Input )
+ { return false; }
+ std::string Temporary = TemporaryName( Destination );
+ FILE* Output = fopen( Temporary.c_str(), "wb" );
+ if( !Output )
+ {
+  fclose( Input );
+  return false;
+ }
+
+ std::vector<char> Buffer( 1 << 20 );
+ bool Success = true;
+ size_t BytesRead;
+ while( Success && ( BytesRead = fread( Buffer.data(), 1, Buffer.size(), Input ) ) > 0 )
+ { Success = ( fwrite( Buffer.data(), 1, BytesRead, Output ) == BytesRead ); }
+ Success = Success && !ferror( Input );
+ fclose( Input );
+ Success = ( fclose( Output ) == 0 ) && Success;
+ if( !Success )
+ {
+  std::remove( Temporary.c_str() );
+  return false;
+ }
+
+ if( std::rename( Temporary.c_str(), Destination.c_str() ) == 0 )
+ { return true; }
+ // rename does not replace on every platform
+ if( Replace )
+ {
+  std::remove( Destination.c_str() );
+  if( std::rename( Temporary.c_str(), Destination.c_str() ) == 0 )
+  { return true; }
+ }
+ std::remove( Temporary.c_str() );
+ long long Size, ModificationTime;
+ return !Replace && StatBMPFile( Destination.c_str(), Size, ModificationTime );
+}
+
+bool HashFile( const char* FileName, std::string& Hex )
+{
+ FILE* Input = fopen( FileName, "rb" );
+ if( !Input )
+ { return false; }
+ BMPResultKey Content;
+ std::vector<char> Buffer( 1 << 20 );
+ size_t BytesRead;
+ while( ( BytesRead = fread( Buffer.data(), 1, Buffer.size(), Input ) ) > 0 )
+ { Content.AddBytes( Buffer.data(), BytesRead ); }
+ bool Success = !ferror( Input );
+ fclose( Input );
+ Hex = Content.TellHex();
+ return Success;
+}
+
+}
+
+BMPResultKey::BMPResultKey()
+{
+ Lanes[0] = 0xcbf29ce484222325ULL;
+ Lanes[1] = GoldenRatio;
+ Pending = 0;
+ PendingBytes = 0;
+ TotalBytes = 0;
+ AddString( "EasyBMP " _EasyBMP_Version_String_ );
+}
+
+void BMPResultKey::AddWord( unsigned long long Word )
+{
+ Lanes[0] = ( Lanes[0] ^ Word ) * FNVPrime;
+ Lanes[0] ^= Lanes[0] >> 32;
+ Lanes[1] = ( Lanes[1] + Word ) * GoldenRatio;
+ Lanes[1] ^= Lanes[1] >> 29;
+}
+
+void BMPResultKey::AddBytes( const void* Data, size_t Size )
+{
+ const ebmpBYTE* Bytes = (const ebmpBYTE*) Data;
+ TotalBytes += Size;
+
+ // finish a word left over from the previous call first
+ while( PendingBytes > 0 && Size > 0 )
+ {
+  Pending |= (unsigned long long) *Bytes++ << ( 8*PendingBytes );
+  Size--;
+  if( ++PendingBytes == 8 )
+  {
+   AddWord( Pending );
+   Pending = 0;
+   PendingBytes = 0;
+  }
+ }
+ while( Size >= 8 )
+ {
+  unsigned long long Word;
+  memcpy( &Word, Bytes, 8 );
+  AddWord( Word );
+  Bytes += 8;
+  Size -= 8;
+ }
+ while( Size > 0 )
+ {
+  Pending |= (unsigned long long) *Bytes++ << ( 8*PendingBytes );
+  PendingBytes++;
+  Size--;
+ }
+}
+
+void BMPResultKey::AddInt( long long Value )
+{ AddBytes( &Value, sizeof(Value) ); }
+
+void BMPResultKey::AddFloat( float Value )
+{
+ // +0 and -0 are the same parameter
+ if( Value == 0.0f )
+ { Value = 0.0f; }
+ ebmpDWORD Bits;
+ memcpy( &Bits, &Value, 4 );
+ AddInt( (long long) Bits );
+}
+
+void BMPResultKey::AddString( const std::string& Value )
+{
+ AddInt( (long long) Value.size() );
+ AddBytes( Value.data(), Value.size() );
+}
+
+std::string BMPResultKey::TellHex( void ) const
+{
+ BMPResultKey Final( *this );
+ if( Final.PendingBytes > 0 )
+ { Final.AddWord( Final.Pending ); }
+ Final.AddWord( Final.TotalBytes );
+ unsigned long long High = FinalMix( Final.Lanes[0] + Final.Lanes[1] );
+ unsigned long long Low = FinalMix( Final.Lanes[1] ^ High );
+
+ static const char Digits[] = "0123456789abcdef";
+ std::string Hex( 32, '0' );
+ for( int n=0 ; n < 16 ; n++ )
+ {
+  Hex[15-n] = Digits[ ( High >> (4*n) ) & 15 ];
+  Hex[31-n] = Digits[ ( Low >> (4*n) ) & 15 ];
+ }
+ return Hex;
+}
+
+BMPResultCache::BMPResultCache( const std::string& NewDirectory, long long NewByteBudget )
+{
+ Directory = NewDirectory;
+ ByteBudget = NewByteBudget;
+#ifdef _WIN32
+ _mkdir( Directory.c_str() );
+#else
+ mkdir( Directory.c_str(), 0777 );
+#endif
+ LoadInputIndex();
+}
+
+bool BMPResultCache::LoadInputIndex( void )
+{
+ std::ifstream Input( ( Directory + "/inputs.idx" ).c_str() );
+ if( !Input )
+ { return false; }
+
+ // FileName is last on the line so it may contain spaces
+ std::string Line;
+ while( std::getline( Input, Line ) )
+ {
+  std::istringstream Fields( Line );
+  InputHash Hash;
+  std::string FileName;
+  Fields >> Hash.FileSize >> Hash.ModificationTime >> Hash.Hex;
+  if( !Fields || Hash.Hex.size() != 32 )
+  { continue; }
+  Fields.get();
+  std::getline( Fields, FileName );
+  if( FileName.empty() )
+  { continue; }
+  Inputs[FileName] = Hash;
+ }
+ return true;
+}
+
+bool BMPResultCache::SaveInputIndex( void )
+{
+ std::string IndexName = Directory + "/inputs.idx";
+ std::string TempName = TemporaryName( IndexName );
+ {
+  std::ofstream Output( TempName.c_str() );
+  if( !Output )
+  { return false; }
+  for( std::unordered_map<std::string,InputHash>::const_iterator it = Inputs.begin() ;
+       it != Inputs.end() ; ++it )
+  {
+   Output << it->second.FileSize << ' ' << it->second.ModificationTime << ' '
+          << it->second.Hex << ' ' << it->first << '\n';
+  }
+  if( !Output )
+  {
+   Output.close();
+   std::remove( TempName.c_str() );
+   return false;
+  }
+ }
+ if( std::rename( TempName.c_str(), IndexName.c_str() ) == 0 )
+ { return true; }
+ std::remove( IndexName.c_str() );
+ if( std::rename( TempName.c_str(), IndexName.c_str() ) == 0 )
+ { return true; }
+ std::remove( TempName.c_str() );
+ return false;
+}
+
+bool BMPResultCache::AddInput( BMPResultKey& Key, const std::string& FileName )
+{
+ using namespace std;
+ long long FileSize, ModificationTime;
+ if( !StatBMPFile( FileName.c_str(), FileSize, ModificationTime ) )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Cannot open file "
+        << FileName << " for input." << endl;
+  }
+  return false;
+ }
+
+ {
+  lock_guard<mutex> Guard( Lock );
+  unordered_map<string,InputHash>::const_iterator it = Inputs.find( FileName );
+  if( it != Inputs.end() && it->second.FileSize == FileSize &&
+      it->second.ModificationTime == ModificationTime )
+  {
+   Key.AddString( it->second.Hex );
+   return true;
+  }
+ }
+
+ InputHash Hash;
+ if( !HashFile( FileName.c_str(), Hash.Hex ) )
+ { return false; }
+ Key.AddString( Hash.Hex );
+
+ // remember it only if the file did not change while it was read
+ if( StatBMPFile( FileName.c_str(), Hash.FileSize, Hash.ModificationTime ) &&
+     Hash.FileSize == FileSize && Hash.ModificationTime == ModificationTime )
+ {
+  lock_guard<mutex> Guard( Lock );
+  Inputs[FileName] = Hash;
+  SaveInputIndex();
+ }
+ return true;
+}
+
+std::string BMPResultCache::TellEntryPath( const BMPResultKey& Key ) const
+{ return Directory + "/" + Key.TellHex() + ".bmp"; }
+
+bool BMPResultCache::Fetch( const BMPResultKey& Key, const char* OutputFileName )
+{
+ std::string Entry = TellEntryPath( Key );
+ if( !CopyFileAtomically( Entry.c_str(), OutputFileName, true ) )
+ { return false; }
+ // a hit makes the entry the most recently used
+#ifdef _WIN32
+ _utime( Entry.c_str(), NULL );
+#else
+ utime( Entry.c_str(), NULL );
+#endif
+ return true;
+}
+
+bool BMPResultCache::Store( const BMPResultKey& Key, const char* FileName )
+{
+ if( !CopyFileAtomically( FileName, TellEntryPath( Key ), false ) )
+ { return false; }
+ Evict();
+ return true;
+}
+
+long long BMPResultCache::TellBytesUsed( void )
+{
+ std::vector<CacheFile> Files;
+ ListEntries( Directory, Files );
+ long long Bytes = 0;
+ for( size_t n=0 ; n < Files.size() ; n++ )
+ { Bytes += Files[n].Size; }
+ return Bytes;
+}
+
+void BMPResultCache::Evict( void )
+{
+ std::vector<CacheFile> Files;
+ ListEntries( Directory, Files );
+ long long Bytes = 0;
+ for( size_t n=0 ; n < Files.size() ; n++ )
+ { Bytes += Files[n].Size; }
+ if( Bytes <= ByteBudget )
+ { return; }
+
+ std::sort( Files.begin(), Files.end(),
+  []( const CacheFile& A, const CacheFile& B )
+  { return A.ModificationTime < B.ModificationTime; } );
+ for( size_t n=0 ; n < Files.size() && Bytes > ByteBudget ; n++ )
+ {
+  if( std::remove( Files[n].Path.c_str() ) == 0 )
+  { Bytes -= Files[n].Size; }
+ }
+}
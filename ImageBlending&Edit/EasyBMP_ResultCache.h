@@ -0,0 +1,88 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_ResultCache.h           *
+*                                                *
+* description: A content-addressed on-disk cache *
+*              of finished output files          *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_ResultCache_h_
+#define _EasyBMP_ResultCache_h_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A 128-bit hash of everything an output depends on. Fields are added
+// in a fixed order; AddBytes streams, so a file may be added in pieces.
+// Not cryptographic: it only has to tell honest inputs apart.
+
+class BMPResultKey
+{
+ public:
+ BMPResultKey(); // seeded with the EasyBMP version
+
+ void AddBytes( const void* Data, size_t Size );
+ void AddInt( long long Value );
+ void AddFloat( float Value );
+ void AddString( const std::string& Value );
+
+ // 32 hex digits; also the entry's file name in the cache
+ std::string TellHex( void ) const;
+
+ private:
+ void AddWord( unsigned long long Word );
+
+ unsigned long long Lanes[2];
+ unsigned long long Pending;
+ int PendingBytes;
+ unsigned long long TotalBytes;
+};
+
+// Finished output files stored under the hex of their key in Directory.
+// Entries are written to a temporary name and renamed into place, so a
+// reader never sees a partial file and concurrent writers of the same
+// key are harmless. A hit refreshes the entry's modification time;
+// once the entries exceed ByteBudget, the stalest are deleted.
+
+class BMPResultCache
+{
+ public:
+ BMPResultCache( const std::string& Directory, long long ByteBudget );
+
+ // Adds the content hash of an input file to Key. Hashes are remembered
+ // by path, size and modification time (in Directory/inputs.idx), so an
+ // unchanged input is only read once. False if the file can't be read.
+ bool AddInput( BMPResultKey& Key, const std::string& FileName );
+
+ // On a hit, copies the cached output to OutputFileName and returns true.
+ bool Fetch( const BMPResultKey& Key, const char* OutputFileName );
+
+ // Copies a freshly written output into the cache, then evicts.
+ bool Store( const BMPResultKey& Key, const char* FileName );
+
+ std::string TellEntryPath( const BMPResultKey& Key ) const;
+ long long TellBytesUsed( void );
+ void Evict( void );
+
+ private:
+ struct InputHash
+ {
+  long long FileSize;
+  long long ModificationTime;
+  std::string Hex;
+ };
+
+ bool LoadInputIndex( void );
+ bool SaveInputIndex( void );
+
+ std::string Directory;
+ long long ByteBudget;
+ std::mutex Lock;
+ std::unordered_map<std::string,InputHash> Inputs;
+};
+
+#endif
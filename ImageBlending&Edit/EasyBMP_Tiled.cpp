@@ -0,0 +1,576 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Tiled.cpp               *
+*                                                *
+* description: A tiled intermediate format for   *
+*              random access into large images   *
+*                                                *
+*************************************************/
+
+#include "EasyBMP.h"
+#include "EasyBMP_Tiled.h"
+#include "EasyBMP_Parallel.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern bool EasyBMPwarnings;
+
+namespace
+{
+
+const int TiledHeaderSize = 64;
+const int TiledIndexEntrySize = 16;
+const int TiledVersion = 1;
+const int TiledCompressed = 1;
+
+void PutDWORD( ebmpBYTE* Data, ebmpDWORD Value )
+{
+ for( int n=0 ; n < 4 ; n++ )
+ { Data[n] = (ebmpBYTE) ( Value >> (8*n) ); }
+}
+
+void PutQWORD( ebmpBYTE* Data, unsigned long long Value )
+{
+ for( int n=0 ; n < 8 ; n++ )
+ { Data[n] = (ebmpBYTE) ( Value >> (8*n) ); }
+}
+
+ebmpDWORD GetDWORD( const ebmpBYTE* Data )
+{
+ return (ebmpDWORD) Data[0] | ( (ebmpDWORD) Data[1] << 8 )
+      | ( (ebmpDWORD) Data[2] << 16 ) | ( (ebmpDWORD) Data[3] << 24 );
+}
+
+unsigned long long GetQWORD( const ebmpBYTE* Data )
+{ return (unsigned long long) GetDWORD( Data ) | ( (unsigned long long) GetDWORD( Data+4 ) << 32 ); }
+
+// PackBits: a header byte n < 128 is followed by n+1 literal bytes,
+// n > 128 by one byte repeated 257-n times
+
+void PackBits( const ebmpBYTE* Input, int Size, std::vector<ebmpBYTE>& Output )
+{
+ int i = 0;
+ while( i < Size )
+ {
+  int Run = 1;
+  while( i+Run < Size && Run < 128 && Input[i+Run] == Input[i] )
+  { Run++; }
+  if( Run >= 3 )
+  {
+   Output.push_back( (ebmpBYTE) ( 257 - Run ) );
+   Output.push_back( Input[i] );
+   i += Run;
+   continue;
+  }
+  // a literal stretch ends where a run of three begins
+  int Start = i;
+  while( i < Size && i - Start < 128 )
+  {
+   if( i+2 < Size && Input[i] == Input[i+1] && Input[i] == Input[i+2] )
+   { break; }
+   i++;
+  }
+  Output.push_back( (ebmpBYTE) ( i - Start - 1 ) );
+  Output.insert( Output.end(), Input + Start, Input + i );
+ }
+}
+
+bool UnpackBits( const ebmpBYTE* Input, int Size, ebmpBYTE* Output, int OutputSize )
+{
+ int i = 0;
+ int o = 0;
+ while( i < Size && o < OutputSize )
+ {
+  int Header = Input[i++];
+  if( Header < 128 )
+  {
+   int Count = Header + 1;
+   if( i + Count > Size || o + Count > OutputSize )
+   { return false; }
+   memcpy( Output + o, Input + i, Count );
+   i += Count;
+   o += Count;
+  }
+  else if( Header > 128 )
+  {
+   int Count = 257 - Header;
+   if( i >= Size || o + Count > OutputSize )
+   { return false; }
+   memset( Output + o, Input[i++], Count );
+   o += Count;
+  }
+ }
+ return o == OutputSize;
+}
+
+// a tile's pixels as four planes of left-neighbour differences, packed
+
+void CompressTile( const ebmpBYTE* Pixels, int Width, int Height,
+                   std::vector<ebmpBYTE>& Output )
+{
+ std::vector<ebmpBYTE> Plane( (size_t) Width * Height );
+ for( int c=0 ; c < 4 ; c++ )
+ {
+  for( int j=0 ; j < Height ; j++ )
+  {
+   const ebmpBYTE* Row = Pixels + (size_t) j * Width * 4 + c;
+   ebmpBYTE* Target = Plane.data() + (size_t) j * Width;
+   ebmpBYTE Previous = 0;
+   for( int i=0 ; i < Width ; i++ )
+   {
+    Target[i] = (ebmpBYTE) ( Row[4*i] - Previous );
+    Previous = Row[4*i];
+   }
+  }
+  PackBits( Plane.data(), (int) Plane.size(), Output );
+ }
+}
+
+bool DecompressTile( const ebmpBYTE* Data, int Size, int Width, int Height,
+                     ebmpBYTE* Pixels )
+{
+ int PlaneSize = Width * Height;
+ std::vector<ebmpBYTE> Planes( (size_t) PlaneSize * 4 );
+ if( !UnpackBits( Data, Size, Planes.data(), PlaneSize * 4 ) )
+ { return false; }
+ for( int c=0 ; c < 4 ; c++ )
+ {
+  const ebmpBYTE* Plane = Planes.data() + (size_t) c * PlaneSize;
+  for( int j=0 ; j < Height ; j++ )
+  {
+   const ebmpBYTE* Source = Plane + (size_t) j * Width;
+   ebmpBYTE* Row = Pixels + (size_t) j * Width * 4 + c;
+   ebmpBYTE Previous = 0;
+   for( int i=0 ; i < Width ; i++ )
+   {
+    Previous = (ebmpBYTE) ( Previous + Source[i] );
+    Row[4*i] = Previous;
+   }
+  }
+ }
+ return true;
+}
+
+bool PositionedRead( int FileDescriptor, ebmpBYTE* Data, int Size, long long Offset )
+{
+#ifdef _WIN32
+ HANDLE File = (HANDLE) _get_osfhandle( FileDescriptor );
+ int Done = 0;
+ while( Done < Size )
+ {
+  OVERLAPPED Position;
+  memset( &Position, 0, sizeof(Position) );
+  Position.Offset = (DWORD) ( Offset + Done );
+  Position.OffsetHigh = (DWORD) ( ( Offset + Done ) >> 32 );
+  DWORD BytesRead = 0;
+  if( !ReadFile( File, Data + Done, (DWORD) ( Size - Done ), &BytesRead, &Position ) ||
+      BytesRead == 0 )
+  { return false; }
+  Done += (int) BytesRead;
+ }
+#else
+ int Done = 0;
+ while( Done < Size )
+ {
+  ssize_t BytesRead = pread( FileDescriptor, Data + Done, Size - Done, (off_t) ( Offset + Done ) );
+  if( BytesRead <= 0 )
+  { return false; }
+  Done += (int) BytesRead;
+ }
+#endif
+ return true;
+}
+
+}
+
+bool WriteTiledImage( BMP& Input, const char* FileName, int TileSize,
+                      bool Compress, int NumberOfThreads )
+{
+ using namespace std;
+ if( TileSize < 1 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Tile size must be positive." << endl;
+  }
+  return false;
+ }
+ FILE* fp = fopen( FileName, "wb" );
+ if( !fp )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Cannot open file "
+        << FileName << " for output." << endl;
+  }
+  return false;
+ }
+
+ int Width = Input.TellWidth();
+ int Height = Input.TellHeight();
+ int TilesAcross = ( Width + TileSize - 1 ) / TileSize;
+ int TilesDown = ( Height + TileSize - 1 ) / TileSize;
+
+ ebmpBYTE Header[TiledHeaderSize];
+ memset( Header, 0, TiledHeaderSize );
+ memcpy( Header, "EBMPTILE", 8 );
+ PutDWORD( Header+8, TiledVersion );
+ PutDWORD( Header+12, Width );
+ PutDWORD( Header+16, Height );
+ PutDWORD( Header+20, TileSize );
+ PutDWORD( Header+24, TileSize );
+ PutDWORD( Header+28, Input.TellBitDepth() );
+ PutDWORD( Header+32, TilesAcross );
+ PutDWORD( Header+36, TilesDown );
+ bool Success = ( fwrite( Header, 1, TiledHeaderSize, fp ) == (size_t) TiledHeaderSize );
+
+ // one row of tiles is gathered and compressed in parallel, then
+ // written in order
+ vector<ebmpBYTE> IndexData( (size_t) TilesAcross * TilesDown * TiledIndexEntrySize );
+ vector< vector<ebmpBYTE> > Stored( TilesAcross );
+ vector<int> Flags( TilesAcross );
+ long long Offset = TiledHeaderSize;
+ for( int ty=0 ; ty < TilesDown && Success ; ty++ )
+ {
+  EasyBMPparallelFor( 0, TilesAcross, NumberOfThreads,
+   [&]( int Begin, int End )
+   {
+    vector<ebmpBYTE> Pixels;
+    for( int tx=Begin ; tx < End ; tx++ )
+    {
+     int Left = tx * TileSize;
+     int Top = ty * TileSize;
+     int TileWidth = min( TileSize, Width - Left );
+     int TileHeight = min( TileSize, Height - Top );
+     Pixels.resize( (size_t) TileWidth * TileHeight * 4 );
+     for( int j=0 ; j < TileHeight ; j++ )
+     {
+      for( int i=0 ; i < TileWidth ; i++ )
+      {
+       RGBApixel Pixel = Input.GetPixel( Left+i, Top+j );
+       memcpy( &Pixels[ ( (size_t) j * TileWidth + i ) * 4 ], &Pixel, 4 );
+      }
+     }
+     Stored[tx].clear();
+     Flags[tx] = 0;
+     if( Compress )
+     {
+      CompressTile( Pixels.data(), TileWidth, TileHeight, Stored[tx] );
+      Flags[tx] = TiledCompressed;
+     }
+     if( !Compress || Stored[tx].size() >= Pixels.size() )
+     {
+      Stored[tx].swap( Pixels );
+      Flags[tx] = 0;
+     }
+    }
+   } );
+
+  for( int tx=0 ; tx < TilesAcross && Success ; tx++ )
+  {
+   ebmpBYTE* Entry = &IndexData[ ( (size_t) ty * TilesAcross + tx ) * TiledIndexEntrySize ];
+   PutQWORD( Entry, (unsigned long long) Offset );
+   PutDWORD( Entry+8, (ebmpDWORD) Stored[tx].size() );
+   PutDWORD( Entry+12, Flags[tx] );
+   Success = ( fwrite( Stored[tx].data(), 1, Stored[tx].size(), fp ) == Stored[tx].size() );
+   Offset += (long long) Stored[tx].size();
+  }
+ }
+
+ // the index goes last, so its offset is patched into the header
+ Success = Success &&
+           fwrite( IndexData.data(), 1, IndexData.size(), fp ) == IndexData.size();
+ PutQWORD( Header+40, (unsigned long long) Offset );
+ Success = Success && fseek( fp, 40, SEEK_SET ) == 0 &&
+           fwrite( Header+40, 1, 8, fp ) == 8;
+ Success = ( fclose( fp ) == 0 ) && Success;
+ if( !Success && EasyBMPwarnings )
+ {
+  cout << "EasyBMP Error: Could not write " << FileName << "." << endl;
+ }
+ return Success;
+}
+
+bool ReadTiledImage( const char* FileName, BMP& Output )
+{
+ TiledImageReader Reader;
+ if( !Reader.Open( FileName, false ) )
+ { return false; }
+ Output.SetBitDepth( Reader.TellSourceBitDepth() == 32 ? 32 : 24 );
+ return Reader.ReadRegion( 0, 0, Reader.TellWidth(), Reader.TellHeight(), Output );
+}
+
+TiledImageReader::TiledImageReader()
+ : BytesRead( 0 )
+{
+ FileDescriptor = -1;
+ Map = NULL;
+ MapSize = 0;
+ Width = Height = 0;
+ TileWidth = TileHeight = 0;
+ TilesAcross = TilesDown = 0;
+ SourceBitDepth = 0;
+}
+
+TiledImageReader::~TiledImageReader()
+{ Close(); }
+
+void TiledImageReader::Close( void )
+{
+#ifndef _WIN32
+ if( Map )
+ { munmap( (void*) Map, (size_t) MapSize ); }
+#endif
+ Map = NULL;
+ MapSize = 0;
+ if( FileDescriptor >= 0 )
+ {
+#ifdef _WIN32
+  _close( FileDescriptor );
+#else
+  close( FileDescriptor );
+#endif
+ }
+ FileDescriptor = -1;
+ Index.clear();
+ Width = Height = 0;
+}
+
+bool TiledImageReader::Open( const char* FileName, bool UseMemoryMap )
+{
+ using namespace std;
+ Close();
+ BytesRead = 0;
+#ifdef _WIN32
+ FileDescriptor = _open( FileName, _O_RDONLY | _O_BINARY );
+ (void) UseMemoryMap;
+#else
+ FileDescriptor = open( FileName, O_RDONLY );
+#endif
+ if( FileDescriptor < 0 )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Cannot open file "
+        << FileName << " for input." << endl;
+  }
+  return false;
+ }
+
+ ebmpBYTE Header[TiledHeaderSize];
+ bool Valid = PositionedRead( FileDescriptor, Header, TiledHeaderSize, 0 ) &&
+              memcmp( Header, "EBMPTILE", 8 ) == 0 &&
+              (int) GetDWORD( Header+8 ) == TiledVersion;
+ if( Valid )
+ {
+  Width = (int) GetDWORD( Header+12 );
+  Height = (int) GetDWORD( Header+16 );
+  TileWidth = (int) GetDWORD( Header+20 );
+  TileHeight = (int) GetDWORD( Header+24 );
+  SourceBitDepth = (int) GetDWORD( Header+28 );
+  TilesAcross = (int) GetDWORD( Header+32 );
+  TilesDown = (int) GetDWORD( Header+36 );
+  Valid = Width > 0 && Height > 0 && TileWidth > 0 && TileHeight > 0 &&
+          TilesAcross == ( Width + TileWidth - 1 ) / TileWidth &&
+          TilesDown == ( Height + TileHeight - 1 ) / TileHeight;
+ }
+
+ // the index and every tile it points at must lie inside the file, so
+ // a corrupt entry fails here rather than in FetchTile
+ long long FileSize = 0;
+ if( Valid )
+ {
+#ifdef _WIN32
+  struct _stat64 Status;
+  Valid = ( _fstat64( FileDescriptor, &Status ) == 0 );
+#else
+  struct stat Status;
+  Valid = ( fstat( FileDescriptor, &Status ) == 0 );
+#endif
+  FileSize = (long long) Status.st_size;
+ }
+ if( Valid )
+ {
+  long long IndexOffset = (long long) GetQWORD( Header+40 );
+  long long Tiles = (long long) TilesAcross * TilesDown;
+  Valid = IndexOffset >= 0 && IndexOffset <= FileSize &&
+          Tiles <= ( FileSize - IndexOffset ) / TiledIndexEntrySize;
+  vector<ebmpBYTE> IndexData;
+  if( Valid )
+  {
+   IndexData.resize( (size_t) Tiles * TiledIndexEntrySize );
+   Valid = PositionedRead( FileDescriptor, IndexData.data(), (int) IndexData.size(), IndexOffset );
+   Index.resize( (size_t) Tiles );
+  }
+  for( int n=0 ; n < (int) Index.size() && Valid ; n++ )
+  {
+   const ebmpBYTE* Entry = &IndexData[ (size_t) n * TiledIndexEntrySize ];
+   Index[n].Offset = (long long) GetQWORD( Entry );
+   Index[n].Size = (int) GetDWORD( Entry+8 );
+   Index[n].Flags = (int) GetDWORD( Entry+12 );
+   Valid = Index[n].Offset >= 0 && Index[n].Size >= 0 &&
+           Index[n].Offset <= FileSize - Index[n].Size;
+  }
+  BytesRead = TiledHeaderSize + (long long) IndexData.size();
+#ifndef _WIN32
+  if( Valid && UseMemoryMap && FileSize > 0 )
+  {
+   void* Mapped = mmap( NULL, (size_t) FileSize, PROT_READ, MAP_SHARED, FileDescriptor, 0 );
+   if( Mapped != MAP_FAILED )
+   {
+    Map = (const ebmpBYTE*) Mapped;
+    MapSize = FileSize;
+   }
+  }
+#endif
+ }
+ if( !Valid )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: " << FileName
+        << " is not a valid tiled image." << endl;
+  }
+  Close();
+  return false;
+ }
+ return true;
+}
+
+int TiledImageReader::TellWidth( void ) const
+{ return Width; }
+
+int TiledImageReader::TellHeight( void ) const
+{ return Height; }
+
+int TiledImageReader::TellTileWidth( void ) const
+{ return TileWidth; }
+
+int TiledImageReader::TellTileHeight( void ) const
+{ return TileHeight; }
+
+int TiledImageReader::TellSourceBitDepth( void ) const
+{ return SourceBitDepth; }
+
+long long TiledImageReader::TellBytesRead( void ) const
+{ return BytesRead; }
+
+// points Data at the stored bytes of one tile: straight into the map,
+// or into Buffer after a positioned read
+
+bool TiledImageReader::FetchTile( int Tile, std::vector<ebmpBYTE>& Buffer,
+                                  const ebmpBYTE*& Data )
+{
+ const TileEntry& Entry = Index[Tile];
+ BytesRead += Entry.Size;
+ if( Map )
+ {
+  if( Entry.Offset < 0 || Entry.Offset + Entry.Size > MapSize )
+  { return false; }
+  Data = Map + Entry.Offset;
+  return true;
+ }
+ Buffer.resize( Entry.Size );
+ Data = Buffer.data();
+ return PositionedRead( FileDescriptor, Buffer.data(), Entry.Size, Entry.Offset );
+}
+
+bool TiledImageReader::ReadRegion( int Left, int Top, int RegionWidth, int RegionHeight,
+                                   RGBApixel* Output, int Stride )
+{
+ using namespace std;
+ if( FileDescriptor < 0 || RegionWidth <= 0 || RegionHeight <= 0 ||
+     Left < 0 || Top < 0 || Left + RegionWidth > Width || Top + RegionHeight > Height )
+ {
+  if( EasyBMPwarnings )
+  {
+   cout << "EasyBMP Error: Requested region lies outside the tiled image." << endl;
+  }
+  return false;
+ }
+
+ int FirstX = Left / TileWidth;
+ int LastX = ( Left + RegionWidth - 1 ) / TileWidth;
+ int FirstY = Top / TileHeight;
+ int LastY = ( Top + RegionHeight - 1 ) / TileHeight;
+ int Across = LastX - FirstX + 1;
+ int Tiles = Across * ( LastY - FirstY + 1 );
+
+ atomic<bool> Success( true );
+ EasyBMPparallelFor( 0, Tiles, GetEasyBMPthreads(),
+  [&]( int Begin, int End )
+  {
+   vector<ebmpBYTE> Buffer;
+   vector<ebmpBYTE> Pixels;
+   for( int n=Begin ; n < End && Success ; n++ )
+   {
+    int tx = FirstX + n % Across;
+    int ty = FirstY + n / Across;
+    int TileLeft = tx * TileWidth;
+    int TileTop = ty * TileHeight;
+    int ThisWidth = min( TileWidth, Width - TileLeft );
+    int ThisHeight = min( TileHeight, Height - TileTop );
+    int Tile = ty * TilesAcross + tx;
+
+    const ebmpBYTE* Data = NULL;
+    if( !FetchTile( Tile, Buffer, Data ) )
+    { Success = false; break; }
+    if( Index[Tile].Flags & TiledCompressed )
+    {
+     Pixels.resize( (size_t) ThisWidth * ThisHeight * 4 );
+     if( !DecompressTile( Data, Index[Tile].Size, ThisWidth, ThisHeight, Pixels.data() ) )
+     { Success = false; break; }
+     Data = Pixels.data();
+    }
+    else if( Index[Tile].Size != ThisWidth * ThisHeight * 4 )
+    { Success = false; break; }
+
+    // the part of this tile inside the requested rectangle
+    int x0 = max( Left, TileLeft );
+    int x1 = min( Left + RegionWidth, TileLeft + ThisWidth );
+    int y0 = max( Top, TileTop );
+    int y1 = min( Top + RegionHeight, TileTop + ThisHeight );
+    for( int y=y0 ; y < y1 ; y++ )
+    {
+     memcpy( Output + (size_t) ( y - Top ) * Stride + ( x0 - Left ),
+             Data + ( (size_t) ( y - TileTop ) * ThisWidth + ( x0 - TileLeft ) ) * 4,
+             (size_t) ( x1 - x0 ) * 4 );
+    }
+   }
+  } );
+ if( !Success && EasyBMPwarnings )
+ {
+  cout << "EasyBMP Error: Could not read proper amount of data." << endl;
+ }
+ return Success;
+}
+
+bool TiledImageReader::ReadRegion( int Left, int Top, int RegionWidth, int RegionHeight,
+                                   BMP& Output )
+{
+ if( RegionWidth <= 0 || RegionHeight <= 0 )
+ { return ReadRegion( Left, Top, RegionWidth, RegionHeight, NULL, 0 ); }
+ std::vector<RGBApixel> Pixels( (size_t) RegionWidth * RegionHeight );
+ if( !ReadRegion( Left, Top, RegionWidth, RegionHeight, Pixels.data(), RegionWidth ) )
+ { return false; }
+ Output.SetSize( RegionWidth, RegionHeight );
+ for( int j=0 ; j < RegionHeight ; j++ )
+ {
+  for( int i=0 ; i < RegionWidth ; i++ )
+  { *Output( i, j ) = Pixels[ (size_t) j * RegionWidth + i ]; }
+ }
+ return true;
+}
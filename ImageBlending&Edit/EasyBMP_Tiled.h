@@ -0,0 +1,101 @@
+/*************************************************
+*                                                *
+*  EasyBMP Cross-Platform Windows Bitmap Library *
+*                                                *
+*          file: EasyBMP_Tiled.h                 *
+*                                                *
+* description: A tiled intermediate format for   *
+*              random access into large images   *
+*                                                *
+*************************************************/
+
+#ifndef _EasyBMP_Tiled_h_
+#define _EasyBMP_Tiled_h_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// File layout, all little-endian:
+//
+//   64-byte header: "EBMPTILE", version, width, height, tile width,
+//                   tile height, source bit depth, tiles across,
+//                   tiles down, index offset (64-bit)
+//   the tiles, left to right and top to bottom
+//   the index: per tile a 64-bit offset, a 32-bit stored size and
+//              32-bit flags (bit 0: compressed)
+//
+// A tile holds its pixels top row first as B,G,R,A bytes; tiles on the
+// right and bottom edges are clipped to the image. Compressed tiles
+// store each channel as a plane of horizontal differences, PackBits
+// run-length coded; a tile that would not shrink is stored raw.
+
+// Converts Input (any bit depth) to a tiled file. Tiles are square,
+// TileSize pixels on a side, and are compressed in parallel on
+// NumberOfThreads threads (<= 0: one per core).
+
+bool WriteTiledImage( BMP& Input, const char* FileName, int TileSize,
+                      bool Compress, int NumberOfThreads );
+
+// Decodes a whole tiled file back into a BMP (32 bits if the source
+// was, otherwise 24).
+
+bool ReadTiledImage( const char* FileName, BMP& Output );
+
+// Random access into a tiled file. Only the tiles that overlap a
+// requested rectangle are read, with positioned reads or, when asked
+// for on systems that have it, a read-only memory map. ReadRegion may
+// be called from several threads at once.
+
+class TiledImageReader
+{
+ public:
+ TiledImageReader();
+ ~TiledImageReader();
+
+ bool Open( const char* FileName, bool UseMemoryMap );
+ void Close( void );
+
+ int TellWidth( void ) const;
+ int TellHeight( void ) const;
+ int TellTileWidth( void ) const;
+ int TellTileHeight( void ) const;
+ int TellSourceBitDepth( void ) const;
+
+ // Copies the Width x Height rectangle at (Left,Top) into Output, row
+ // by row, top row first, Stride pixels apart. The rectangle has to lie
+ // inside the image.
+ bool ReadRegion( int Left, int Top, int Width, int Height,
+                  RGBApixel* Output, int Stride );
+
+ // Same, into a BMP resized to the rectangle.
+ bool ReadRegion( int Left, int Top, int Width, int Height, BMP& Output );
+
+ // bytes fetched from the file since Open
+ long long TellBytesRead( void ) const;
+
+ private:
+ TiledImageReader( const TiledImageReader& );
+ TiledImageReader& operator=( const TiledImageReader& );
+
+ struct TileEntry
+ {
+  long long Offset;
+  int Size;
+  int Flags;
+ };
+
+ bool FetchTile( int Tile, std::vector<ebmpBYTE>& Buffer, const ebmpBYTE*& Data );
+
+ int FileDescriptor;
+ const ebmpBYTE* Map;
+ long long MapSize;
+ int Width, Height;
+ int TileWidth, TileHeight;
+ int TilesAcross, TilesDown;
+ int SourceBitDepth;
+ std::vector<TileEntry> Index;
+ std::atomic<long long> BytesRead;
+};
+
+#endif
@@ -21,6 +21,8 @@
 #ifndef _EasyBMP_VariousBMPutilities_h_
 #define _EasyBMP_VariousBMPutilities_h_
 
+bool ParseBMPHeaders( const ebmpBYTE* Data, int Size, BMFH& bmfh, BMIH& bmih );
+bool WriteBMPHeaders( FILE* fp, BMFH bmfh, BMIH bmih );
 BMFH GetBMFH( const char* szFileNameIn );
 BMIH GetBMIH( const char* szFileNameIn );
 void DisplayBitmapInfo( const char* szFileNameIn );
@@ -0,0 +1,130 @@
+#include "Histogram.h"
+#include "EasyBMP_Parallel.h"
+#include "Simd.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+const int MIN_BAND = 64;
+
+// Adds the pixels of one column to the four tables, laid out one after
+// the other in counts.
+void CountColumn(const pixel* column, int n, int bins, long long* counts) {
+	long long* red = counts;
+	long long* green = counts + bins;
+	long long* blue = counts + 2 * bins;
+	long long* luma = counts + 3 * bins;
+	float top = (float)(bins - 1);
+#ifdef SIMD_SSE2
+	// the luminance takes the place of alpha, and all four bins come out
+	// of one multiply, clamp and round; a NaN clamps to bin 0
+	__m128 scale = _mm_set1_ps(top);
+	__m128 zero = _mm_setzero_ps();
+	for (int y = 0; y < n; ++y) {
+		const pixel& p = column[y];
+		__m128 v = _mm_set_ps(0.299f * p.r + 0.587f * p.g + 0.114f * p.b, p.b, p.g, p.r);
+		v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, scale), zero), scale);
+		alignas(16) int k[4];
+		_mm_store_si128((__m128i*)k, _mm_cvtps_epi32(v));
+		++red[k[0]];
+		++green[k[1]];
+		++blue[k[2]];
+		++luma[k[3]];
+	}
+#else
+	auto bin = [top](float v) {
+		v *= top;
+		if (!(v > 0))
+			return 0;
+		if (v > top)
+			v = top;
+		return (int)std::nearbyint(v);
+	};
+	for (int y = 0; y < n; ++y) {
+		const pixel& p = column[y];
+		++red[bin(p.r)];
+		++green[bin(p.g)];
+		++blue[bin(p.b)];
+		++luma[bin(0.299f * p.r + 0.587f * p.g + 0.114f * p.b)];
+	}
+#endif
+}
+
+}
+
+Histogram ComputeHistogram(pixel** map, Rect roi, int bins) {
+	if (bins < 2) {
+		std::cerr << "A histogram needs at least 2 bins." << std::endl;
+		exit(1);
+	}
+	Histogram histogram(bins);
+	histogram.total = (long long)std::max(roi.w, 0) * std::max(roi.h, 0);
+	if (roi.Empty())
+		return histogram;
+
+	// each band counts into a table of its own, so no two threads ever
+	// write the same counter, and adds it in once it is done
+	std::vector<long long> counts(4 * (size_t)bins);
+	std::mutex merge;
+	EasyBMPparallelFor(0, roi.w, 0, MIN_BAND, [&](int begin, int end) {
+		std::vector<long long> own(4 * (size_t)bins);
+		for (int x = begin; x < end; ++x) {
+			CountColumn(map[roi.x + x] + roi.y, roi.h, bins, own.data());
+		}
+		std::lock_guard<std::mutex> lock(merge);
+		for (size_t k = 0; k < own.size(); ++k) {
+			counts[k] += own[k];
+		}
+	});
+
+	std::copy(counts.begin(), counts.begin() + bins, histogram.red.begin());
+	std::copy(counts.begin() + bins, counts.begin() + 2 * bins, histogram.green.begin());
+	std::copy(counts.begin() + 2 * bins, counts.begin() + 3 * bins, histogram.blue.begin());
+	std::copy(counts.begin() + 3 * bins, counts.end(), histogram.luma.begin());
+	return histogram;
+}
+
+int OtsuBin(const std::vector<long long>& counts) {
+	double total = 0, weighted = 0;
+	for (size_t k = 0; k < counts.size(); ++k) {
+		total += (double)counts[k];
+		weighted += (double)k * counts[k];
+	}
+
+	// between-class variance, up to a constant factor, for each split
+	int best = 0;
+	double bestVariance = -1;
+	double below = 0, belowWeighted = 0;
+	for (size_t k = 0; k + 1 < counts.size(); ++k) {
+		below += (double)counts[k];
+		belowWeighted += (double)k * counts[k];
+		double above = total - below;
+		if (below == 0 || above == 0)
+			continue;
+		double difference = belowWeighted / below - (weighted - belowWeighted) / above;
+		double variance = below * above * difference * difference;
+		if (variance > bestVariance) {
+			bestVariance = variance;
+			best = (int)k;
+		}
+	}
+	return best;
+}
+
+int PercentileBin(const std::vector<long long>& counts, double fraction) {
+	long long total = 0;
+	for (long long count : counts) {
+		total += count;
+	}
+	double wanted = fraction * (double)total;
+	long long seen = 0;
+	for (size_t k = 0; k < counts.size(); ++k) {
+		seen += counts[k];
+		if ((double)seen >= wanted && seen > 0)
+			return (int)k;
+	}
+	return counts.empty() ? 0 : (int)counts.size() - 1;
+}
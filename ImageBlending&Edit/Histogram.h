@@ -0,0 +1,40 @@
+#pragma once
+#include "Pixel.h"
+#include <vector>
+
+// Counts of the red, green, blue and luminance (0.299 r + 0.587 g +
+// 0.114 b) values of an image. bins is usually 256, which holds colors
+// read from 8-bit files exactly, or 4096; bin k counts the values
+// nearest k / (bins - 1), values outside [0, 1] the nearest end bin.
+struct Histogram {
+	int bins;
+	long long total; // pixels counted
+	std::vector<long long> red, green, blue, luma;
+
+	Histogram() : bins(0), total(0) {}
+	explicit Histogram(int bins) : bins(bins), total(0), red(bins), green(bins), blue(bins), luma(bins) {}
+
+	// The value bin k stands for
+	float Level(int k) const {
+		return (float)k / (bins - 1);
+	}
+	// The top of the values bin k counts, halfway up to the next bin
+	float UpperEdge(int k) const {
+		return (k + 0.5f) / (bins - 1);
+	}
+};
+
+// The histogram of region roi of map, bins at least 2. Each band of
+// columns counts into a histogram of its own, on its own thread, and the
+// bands are added up at the end.
+Histogram ComputeHistogram(pixel** map, Rect roi, int bins);
+
+// The bin that best splits counts into two classes, by Otsu's method:
+// values in bins up to and including it are one class, the rest the
+// other, and the variance between the classes is the largest. 0 if
+// counts is empty.
+int OtsuBin(const std::vector<long long>& counts);
+
+// The first bin at or below which at least fraction (0 to 1) of the
+// counted values lie.
+int PercentileBin(const std::vector<long long>& counts, double fraction);
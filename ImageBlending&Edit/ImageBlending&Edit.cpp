@@ -3,8 +3,25 @@
 #include <iostream>
 #include<cmath>
 #include <cstring>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include "Pixel.h"
+#include "Blend.h"
+#include "Srgb.h"
+#include "PointOps.h"
+#include "Convolve.h"
+#include "Blur.h"
+#include "Integral.h"
+#include "Histogram.h"
+#include "Mask.h"
+#include "Canny.h"
+#include "Morphology.h"
+#include "Components.h"
 
 const int IMG_NUMBER = 3;
+const float BLUR_SIGMA = 8.0f; // of the Gaussian the U key blurs with; any size costs the same
 struct TextTimer {
 	const char* str;
 	unsigned char time;
@@ -21,159 +38,210 @@ struct Vector2i {
 	}
 };
 
-struct pixel {
-	float r, g, b, a;
-
-	pixel() : r(0), g(0), b(0), a(1) {} // Default constructor with initialization
-};
+// The B&W filter compares each pixel with the mean of a window around it
+// (Bradley and Roth), which follows uneven lighting where one global level
+// cannot: a pixel BW_BIAS darker than its surroundings turns navy, the
+// rest gold. The window reaches 1/BW_WINDOW_SHARE of the sprite's larger
+// side each way.
+const int BW_WINDOW_SHARE = 16;
+const float BW_BIAS = 0.15f;
+// The cleaned B&W filter opens and then closes the mask with a square
+// reaching this far, dropping specks and filling pinholes that small.
+const int BW_CLEAN_RADIUS = 1;
+
+pixel BWColor(bool below) {
+	pixel p;
+	if (below) {
+		p.r = 0.0f;
+		p.g = 0.0f;
+		p.b = 0.502f;
+	}
+	else {
+		p.r = 1.0f;
+		p.g = 0.843f;
+		p.b = 0.0f;
+	}
+	return p;
+}
 
+// The filters take an optional region of interest, which must lie inside
+// the sprite, and return a new roi.w x roi.h map holding just the filtered
+// pixels of that region; without one they filter the whole sprite.
 struct Sprite {
 	pixel** PixelMap;
 	int w, h;
-
-	Sprite() : PixelMap(nullptr), w(0), h(0) {}  // Constructor to initialize members
+	int x, y; // placement of the top-left corner on the canvas
+	BlendMode mode; // how the sprite blends onto the layers below it
+	RGBApixel* Bytes; // the 8-bit colors read from file, column by column, or nullptr
+	unsigned char opacity; // the alpha of every pixel, as set by ChangeAlphaVal
+	unsigned generation; // bumped whenever the pixels of PixelMap change
+	Histogram histogram; // of the whole sprite as it was at histogramGeneration; bins is 0 until counted
+	unsigned histogramGeneration;
+
+	Sprite() : PixelMap(nullptr), w(0), h(0), x(0), y(0), mode(BlendMode::Normal), Bytes(nullptr), opacity(255), generation(0), histogramGeneration(0) {}  // Constructor to initialize members
+
+	Rect Bounds() const {
+		return Rect{ 0, 0, w, h };
+	}
+	// The area the sprite covers on the canvas
+	Rect Placement() const {
+		return Rect{ x, y, w, h };
+	}
 
 	pixel** ToBW() {
-		// Allocate memory for the new black and white pixel map
-		pixel** pixelMapVar = new(std::nothrow) pixel * [w];
-		if (!pixelMapVar) {
-			std::cerr << "Memory allocation failed for PixelMap." << std::endl;
-			exit(1);
-		}
-
-		for (int i = 0; i < w; ++i) {
-			pixelMapVar[i] = new(std::nothrow) pixel[h];
-			if (!pixelMapVar[i]) {
-				std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
-				// Cleanup previously allocated memory before exiting
-				for (int k = 0; k < i; ++k) {
-					delete[] pixelMapVar[k];
-				}
-				delete[] pixelMapVar;
-				exit(1);
-			}
-		}
-
-		// Convert to black and white
-		for (int i = 0; i < w; ++i) {
-			for (int j = 0; j < h; ++j) {
-				// Calculate grayscale value
-				float gray = PixelMap[i][j].r + PixelMap[i][j].g + PixelMap[i][j].b;
-				//std::cout << gray << " " << i << " " << j << "\n";
-				// Apply threshold for binary conversion
-				if (gray <= 1.5f) {
-					pixelMapVar[i][j].r = 0.0f;   // Red channel
-					pixelMapVar[i][j].g = 0.0f;   // Green channel
-					pixelMapVar[i][j].b = 0.502f; // Blue channel
+		return ToBW(Bounds());
+	}
+	// Thresholds r + g + b; see BW_BIAS
+	pixel** ToBW(Rect roi) {
+		return PaintMask(ToBWMask(roi, 1, 1, 1), BWColor(true), BWColor(false), PixelMap, roi);
+	}
+	// The 256-bin histogram of the whole sprite, counted again only once
+	// the pixels have changed
+	const Histogram& Histogram256() {
+		if (histogram.bins == 0 || histogramGeneration != generation) {
+			histogram = ComputeHistogram(PixelMap, Bounds(), 256);
+			histogramGeneration = generation;
+		}
+		return histogram;
+	}
+	// Navy for the luminances counted in or below the bin that Otsu's
+	// method picks from the whole sprite's histogram, gold above
+	pixel** ToOtsuBW(Rect roi) {
+		const Histogram& counts = Histogram256();
+		float level = counts.UpperEdge(OtsuBin(counts.luma));
+		return Render(Threshold(Grayscale(Layer(PixelMap, roi)), level, BWColor(true), BWColor(false)), roi.w, roi.h);
+	}
+	pixel** ToGrayscale() {
+		return ToGrayscale(Bounds());
+	}
+	pixel** ToGrayscale(Rect roi) {
+		return Render(Grayscale(Layer(PixelMap, roi)), roi.w, roi.h);
+	}
+	// Adaptive B&W of the grayscale image: compares each pixel's luminance
+	// with the mean of its window, as ToBW does for r + g + b; see BW_BIAS
+	pixel** ToGrayscaleBW(Rect roi) {
+		return PaintMask(ToBWMask(roi, 0.299f, 0.587f, 0.114f), BWColor(true), BWColor(false), PixelMap, roi);
+	}
+	// Each of the four morphology passes reaches BW_CLEAN_RADIUS further,
+	// so roi reads a halo four times that, clipped to the sprite.
+	pixel** ToCleanBW(Rect roi) {
+		Rect halo = roi.Expand(4 * BW_CLEAN_RADIUS).Intersect(Bounds());
+		Mask mask = ToBWMask(halo, 1, 1, 1);
+		OpenMask(mask, mask, BW_CLEAN_RADIUS, BW_CLEAN_RADIUS);
+		CloseMask(mask, mask, BW_CLEAN_RADIUS, BW_CLEAN_RADIUS);
+		Mask cropped = CropMask(mask, Rect{ roi.x - halo.x, roi.y - halo.y, roi.w, roi.h });
+		return PaintMask(cropped, BWColor(true), BWColor(false), PixelMap, roi);
+	}
+	// Each 8-connected blob of the B&W filter's navy pixels in a color of
+	// its own, on black. Blobs are found within roi only, so one that
+	// crosses its edge is cut there.
+	pixel** ToComponents(Rect roi) {
+		Labeling labeling = LabelComponents(ToBWMask(roi, 1, 1, 1), Connectivity::Eight);
+		pixel** pixelMapVar = AllocPixelMap(roi.w, roi.h);
+		for (int i = 0; i < roi.w; ++i) {
+			for (int j = 0; j < roi.h; ++j) {
+				pixel& out = pixelMapVar[i][j];
+				int label = labeling.At(i, j);
+				if (label == 0) {
+					out.r = out.g = out.b = 0.0f;
 				}
-				else if (gray >= 1.5f) {
-					pixelMapVar[i][j].r = 1.0f;     // Red channel
-					pixelMapVar[i][j].g = 0.843f;   // Green channel
-					pixelMapVar[i][j].b = 0.0f;     // Blue channel
+				else {
+					// scatter the labels over the colors, keeping them bright
+					unsigned hash = (unsigned)label * 2654435761u;
+					out.r = 0.25f + 0.75f * ((hash >> 24) & 255) / 255.0f;
+					out.g = 0.25f + 0.75f * ((hash >> 16) & 255) / 255.0f;
+					out.b = 0.25f + 0.75f * ((hash >> 8) & 255) / 255.0f;
 				}
-				pixelMapVar[i][j].a = PixelMap[i][j].a;  // Preserve the alpha channel
+				out.a = PixelMap[roi.x + i][roi.y + j].a;
 			}
 		}
-
 		return pixelMapVar;
 	}
-	pixel** ToGrayscale() {
-		// Allocate memory for the new grayscale pixel map
-		pixel** pixelMapVar = new(std::nothrow) pixel * [w];
-		if (!pixelMapVar) {
-			std::cerr << "Memory allocation failed for PixelMap." << std::endl;
-			exit(1);
-		}
-
-		for (int i = 0; i < w; ++i) {
-			pixelMapVar[i] = new(std::nothrow) pixel[h];
-			if (!pixelMapVar[i]) {
-				std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
-				// Cleanup previously allocated memory before exiting
-				for (int k = 0; k < i; ++k) {
-					delete[] pixelMapVar[k];
-				}
-				delete[] pixelMapVar;
-				exit(1);
-			}
-		}
-
-		// Convert to grayscale
-		for (int i = 0; i < w; ++i) {
-			for (int j = 0; j < h; ++j) {
-				// Calculate grayscale value using luminance formula
-				float gray = 0.299f * PixelMap[i][j].r + 0.587f * PixelMap[i][j].g + 0.114f * PixelMap[i][j].b;
-
-				// Set grayscale value for r, g, and b
-				pixelMapVar[i][j].r = gray;
-				pixelMapVar[i][j].g = gray;
-				pixelMapVar[i][j].b = gray;
-				pixelMapVar[i][j].a = PixelMap[i][j].a;  // Preserve the alpha channel
+	// Set where wr r + wg g + wb b is below its local mean. The window is
+	// clipped to the sprite, so roi reads a halo as wide as the window
+	// reaches, clipped likewise.
+	Mask ToBWMask(Rect roi, float wr, float wg, float wb) {
+		int radius = std::max(std::max(w, h) / BW_WINDOW_SHARE, 1);
+		Rect halo = roi.Expand(radius).Intersect(Bounds());
+		Plane value(halo.w, halo.h);
+		for (int i = 0; i < halo.w; ++i) {
+			const pixel* column = PixelMap[halo.x + i] + halo.y;
+			float* out = value.Column(i);
+			for (int j = 0; j < halo.h; ++j) {
+				out[j] = wr * column[j].r + wg * column[j].g + wb * column[j].b;
 			}
 		}
 
-		return pixelMapVar;
+		return LocalMeanThreshold(value, Rect{ roi.x - halo.x, roi.y - halo.y, roi.w, roi.h }, radius, BW_BIAS);
+	}
+	// The neighbourhood effects read a halo around roi as far as their
+	// kernel reaches, repeating the sprite's edge pixels beyond it.
+	pixel** ToBlur(Rect roi) {
+		return GaussianBlurMap(PixelMap, w, h, roi, BLUR_SIGMA, Border::Clamp);
+	}
+	pixel** ToSharpen(Rect roi) {
+		static const Kernel sharpen(3, 3, {
+			0, -1, 0,
+			-1, 5, -1,
+			0, -1, 0 });
+		return ConvolveMap(PixelMap, w, h, roi, sharpen, Border::Clamp);
+	}
+	pixel** ToEmboss(Rect roi) {
+		static const Kernel emboss(3, 3, {
+			-2, -1, 0,
+			-1, 1, 1,
+			0, 1, 2 });
+		return ConvolveMap(PixelMap, w, h, roi, emboss, Border::Clamp);
 	}
 	pixel** ToRandFilter() {
-		// Allocate memory for the new black and white pixel map
-		pixel** pixelMapVar = new(std::nothrow) pixel * [w];
-		if (!pixelMapVar) {
-			std::cerr << "Memory allocation failed for PixelMap." << std::endl;
-			exit(1);
-		}
-
-		for (int i = 0; i < w; ++i) {
-			pixelMapVar[i] = new(std::nothrow) pixel[h];
-			if (!pixelMapVar[i]) {
-				std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
-				// Cleanup previously allocated memory before exiting
-				for (int k = 0; k < i; ++k) {
-					delete[] pixelMapVar[k];
-				}
-				delete[] pixelMapVar;
-				exit(1);
-			}
-		}
-
-		// Convert to black and white
-		for (int i = 0; i < w; ++i) {
-			for (int j = 0; j < h; ++j) {
-				float difference = std::abs(PixelMap[i][j - 1].r + PixelMap[i][j - 1].g + PixelMap[i][j - 1].b - PixelMap[i][j].r - PixelMap[i][j].g - PixelMap[i][j].b);
+		return ToRandFilter(Bounds());
+	}
+	// Compares each pixel with the one above it, so the region reads one
+	// row of halo above roi. The top row of the sprite has nothing above
+	// it and counts as unchanged.
+	pixel** ToRandFilter(Rect roi) {
+		pixel black, white;
+		black.r = black.g = black.b = 0.0f;
+		white.r = white.g = white.b = 1.0f;
+		return PaintMask(ToRandMask(roi), black, white, PixelMap, roi);
+	}
+	// Set where r + g + b differs from the pixel above by more than 0.005
+	Mask ToRandMask(Rect roi) {
+		Mask changed(roi.w, roi.h);
+
+		for (int i = 0; i < roi.w; ++i) {
+			const pixel* column = PixelMap[roi.x + i];
+			uint64_t* bits = changed.Column(i);
+			for (int j = 0; j < roi.h; ++j) {
+				int y = roi.y + j;
+				int above = (y > 0) ? y - 1 : y;
+				float difference = std::abs(column[above].r + column[above].g + column[above].b - column[y].r - column[y].g - column[y].b);
 				// Apply threshold for binary conversion
-				if (difference > 0.005f) {
-					pixelMapVar[i][j].r = 0.0f;     // Red channel
-					pixelMapVar[i][j].g = 0.0;   // Green channel
-					pixelMapVar[i][j].b = 0.0f;   // Blue channel
-				}
-				else {
-					pixelMapVar[i][j].r = pixelMapVar[i][j].g = pixelMapVar[i][j].b = 1;
-				}
-				pixelMapVar[i][j].a = PixelMap[i][j].a;  // Preserve the alpha channel
+				if (difference > 0.005f)
+					bits[j >> 6] |= (uint64_t)1 << (j & 63);
 			}
 		}
 
-		return pixelMapVar;
+		return changed;
+	}
+	// Thin gold edges on black. The workspace keeps the intermediate
+	// planes between calls.
+	pixel** ToCanny(Rect roi, CannyWorkspace& workspace) {
+		pixel gold, black;
+		gold.r = 1.0f;
+		gold.g = 0.843f;
+		gold.b = 0.0f;
+		black.r = black.g = black.b = 0.0f;
+		return PaintMask(CannyMap(PixelMap, w, h, roi, CannySettings(), workspace), gold, black, PixelMap, roi);
 	}
 	pixel** toSobelEdgeDetection() {
-		// Allocate memory for the new pixel map for storing Sobel edge detection output
-		pixel** pixelMapVar = new(std::nothrow) pixel * [w];
-		if (!pixelMapVar) {
-			std::cerr << "Memory allocation failed for PixelMap." << std::endl;
-			exit(1);
-		}
-
-		for (int i = 0; i < w; ++i) {
-			pixelMapVar[i] = new(std::nothrow) pixel[h];
-			if (!pixelMapVar[i]) {
-				std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
-				// Cleanup previously allocated memory before exiting
-				for (int k = 0; k < i; ++k) {
-					delete[] pixelMapVar[k];
-				}
-				delete[] pixelMapVar;
-				exit(1);
-			}
-		}
+		return toSobelEdgeDetection(Bounds());
+	}
+	// Needs a 1-pixel halo around roi. The intensities of roi plus halo are
+	// computed once up front; pixels on the sprite's border have no full
+	// neighbourhood and are left black.
+	pixel** toSobelEdgeDetection(Rect roi) {
+		pixel** pixelMapVar = AllocPixelMap(roi.w, roi.h);
 
 		// Sobel operator kernels for x and y gradients
 		int Gx[3][3] = {
@@ -187,18 +255,28 @@ struct Sprite {
 			{ 1, 2, 1 }
 		};
 
-		// Apply Sobel operator
-		for (int i = 1; i < w - 1; ++i) {
-			for (int j = 1; j < h - 1; ++j) {
+		Rect halo = roi.Expand(1).Intersect(Bounds());
+		std::vector<float> intensity((size_t)halo.w * halo.h);
+		for (int i = 0; i < halo.w; ++i) {
+			for (int j = 0; j < halo.h; ++j) {
+				const pixel& src = PixelMap[halo.x + i][halo.y + j];
+				intensity[(size_t)i * halo.h + j] = 0.299f * src.r + 0.587f * src.g + 0.114f * src.b;
+			}
+		}
+
+		// Apply Sobel operator to the interior part of roi
+		Rect inner = roi.Intersect(Rect{ 1, 1, w - 2, h - 2 });
+		for (int i = inner.x; i < inner.x + inner.w; ++i) {
+			for (int j = inner.y; j < inner.y + inner.h; ++j) {
 				float gradX = 0.0f;
 				float gradY = 0.0f;
 
 				// Compute gradients in the x and y directions
 				for (int k = -1; k <= 1; ++k) {
 					for (int l = -1; l <= 1; ++l) {
-						float intensity = 0.299f * PixelMap[i + k][j + l].r + 0.587f * PixelMap[i + k][j + l].g + 0.114f * PixelMap[i + k][j + l].b;
-						gradX += Gx[k + 1][l + 1] * intensity;
-						gradY += Gy[k + 1][l + 1] * intensity;
+						float value = intensity[(size_t)(i + k - halo.x) * halo.h + (j + l - halo.y)];
+						gradX += Gx[k + 1][l + 1] * value;
+						gradY += Gy[k + 1][l + 1] * value;
 					}
 				}
 
@@ -208,23 +286,24 @@ struct Sprite {
 				// Normalize the magnitude to the range [0, 1]
 				float normalizedMagnitude = magnitude / 4.0f;  // Max possible value is 4 for Sobel
 
+				pixel& out = pixelMapVar[i - roi.x][j - roi.y];
 				// Set pixel color based on the magnitude
 				if (normalizedMagnitude > 0.0f) {
 					// Edge detected - set to a nuance of gold
 					// Adjust the intensity of gold based on the magnitude
-					pixelMapVar[i][j].r = 1.0f * normalizedMagnitude;     // Red component of gold
-					pixelMapVar[i][j].g = 0.843f * normalizedMagnitude;   // Green component of gold
-					pixelMapVar[i][j].b = 0.0f;                          // Blue component stays 0
+					out.r = 1.0f * normalizedMagnitude;     // Red component of gold
+					out.g = 0.843f * normalizedMagnitude;   // Green component of gold
+					out.b = 0.0f;                          // Blue component stays 0
 				}
 				else {
 					// No edge - set to dark red
-					pixelMapVar[i][j].r = 0.0f;  // Red channel for dark red
-					pixelMapVar[i][j].g = 0.0f;    // Green channel for dark red
-					pixelMapVar[i][j].b = 0.0f;    // Blue channel for dark red
+					out.r = 0.0f;  // Red channel for dark red
+					out.g = 0.0f;    // Green channel for dark red
+					out.b = 0.0f;    // Blue channel for dark red
 				}
 
 				// Preserve the alpha channel
-				pixelMapVar[i][j].a = PixelMap[i][j].a;
+				out.a = PixelMap[i][j].a;
 			}
 		}
 
@@ -233,112 +312,239 @@ struct Sprite {
 };
 
 void AllocMat(Sprite& sprite) {
-	sprite.PixelMap = new(std::nothrow) pixel * [sprite.w];
-	if (!sprite.PixelMap) {
-		std::cerr << "Memory allocation failed for PixelMap." << std::endl;
+	sprite.PixelMap = AllocPixelMap(sprite.w, sprite.h);
+}
+
+void ReadMat(Sprite& sprite, const BMP& Img) {
+	sprite.Bytes = new(std::nothrow) RGBApixel[(size_t)sprite.w * sprite.h];
+	if (!sprite.Bytes) {
+		std::cerr << "Memory allocation failed for Bytes." << std::endl;
 		exit(1);
 	}
-
+	sprite.opacity = 255;
 	for (int i = 0; i < sprite.w; ++i) {
-		sprite.PixelMap[i] = new(std::nothrow) pixel[sprite.h];
-		if (!sprite.PixelMap[i]) {
-			std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
-			exit(1);
+		RGBApixel* column = sprite.Bytes + (size_t)i * sprite.h;
+		std::copy(Img.Column(i), Img.Column(i) + sprite.h, column);
+		for (int j = 0; j < sprite.h; ++j) {
+			column[j].Alpha = 255; // Default alpha value
 		}
+		ConvertPixels(column, BMP_BGRA32, sprite.PixelMap[i], BMP_RGBAf32, sprite.h);
 	}
+	sprite.generation++;
 }
 
-void ReadMat(Sprite& sprite, BMP& Img) {
-	for (int i = 0; i < sprite.w; ++i) {
-		for (int j = 0; j < sprite.h; ++j) {
-			sprite.PixelMap[i][j].r = Img(i, j)->Red / 255.0f;
-			sprite.PixelMap[i][j].g = Img(i, j)->Green / 255.0f;
-			sprite.PixelMap[i][j].b = Img(i, j)->Blue / 255.0f;
-			sprite.PixelMap[i][j].a = 1.0f; // Default alpha value
+// Fills images[] from the cache and decodes whatever is missing or stale
+// concurrently; a driver that keeps the cache across jobs decodes each
+// shared input only once.
+bool LoadImages(BMPCache& cache, const char* const names[IMG_NUMBER], std::shared_ptr<const BMP> images[IMG_NUMBER]) {
+	BMPBatchLoader loader;
+	for (int i = 0; i < IMG_NUMBER; i++) {
+		images[i] = cache.Find(names[i]);
+		if (!images[i])
+			loader.Submit(names[i], i);
+	}
+	BMPLoadResult loaded;
+	while (loader.WaitNext(loaded)) {
+		if (!loaded.Success) {
+			std::cerr << "Error: Could not open the image file " << loaded.FileName << "!" << std::endl;
+			return false;
 		}
+		images[loaded.Tag] = cache.Insert(loaded.FileName, std::move(loaded.Image), loaded.FileSize, loaded.ModificationTime);
 	}
+	return true;
 }
 
 Vector2i OutputSize(Sprite sprite[]) {
 	int LargestX = 0;
 	int LargestY = 0;
 	for (int i = 0; i < IMG_NUMBER; i++) {
-		if (sprite[i].w > LargestX) LargestX = sprite[i].w;
-		if (sprite[i].h > LargestY) LargestY = sprite[i].h;
+		if (sprite[i].x + sprite[i].w > LargestX) LargestX = sprite[i].x + sprite[i].w;
+		if (sprite[i].y + sprite[i].h > LargestY) LargestY = sprite[i].y + sprite[i].h;
 	}
 	return Vector2i{ LargestX, LargestY };
 }
 
-void WriteFile(const Sprite& sprite) {
+// bitDepth 24 writes the composite as is; 8, 4 or 1 quantizes it to an
+// adaptive palette and dithers before writing. False if the file could
+// not be written.
+bool WriteFile(const Sprite& sprite, int bitDepth = 24) {
 	BMP Output;
-	Vector2 outputSize{ sprite.w, sprite.h };
+	Vector2 outputSize{ (float)sprite.w, (float)sprite.h };
 	Output.SetSize(outputSize.x, outputSize.y);
 	Output.SetBitDepth(24);
 
-	for (int i = 0; i < outputSize.x; ++i) {
-		for (int j = 0; j < outputSize.y; ++j) {
-			Output(i, j)->Red = static_cast<unsigned char>(sprite.PixelMap[i][j].r * 255);
-			Output(i, j)->Green = static_cast<unsigned char>(sprite.PixelMap[i][j].g * 255);
-			Output(i, j)->Blue = static_cast<unsigned char>(sprite.PixelMap[i][j].b * 255);
-			Output(i, j)->Alpha = static_cast<unsigned char>(sprite.PixelMap[i][j].a * 255);
-		}
+	for (int i = 0; i < sprite.w; ++i) {
+		ConvertPixels(sprite.PixelMap[i], BMP_RGBAf32, Output.Column(i), BMP_BGRA32, sprite.h);
 	}
-	Output.WriteToFile("MARBLES2.bmp");
+	if (bitDepth != 24 && !QuantizeImage(Output, bitDepth, 0)) {
+		std::cerr << "Could not quantize the output to " << bitDepth << " bits." << std::endl;
+	}
+	return Output.WriteToFile("MARBLES2.bmp");
+}
+
+// Bump when a change to the blending or writing code alters the output,
+// so results cached by older builds are not reused.
+const int OUTPUT_PIPELINE_VERSION = 4;
+
+// Hashes everything the written composite depends on: the input file
+// contents, each layer's opacity, placement and blend mode and the steps
+// that produced it. The key is built after ScreenOutput has blended, so a
+// hit only replaces WriteFile; the blend itself is never skipped.
+bool OutputKey(BMPResultCache& cache, const char* const names[IMG_NUMBER], Sprite sprite[], bool blended, bool linear, BMPResultKey& key) {
+	key.AddInt(OUTPUT_PIPELINE_VERSION);
+	key.AddInt(24); // WriteFile bit depth
+	if (!blended) {
+		key.AddString("copy");
+		return cache.AddInput(key, names[0]);
+	}
+	key.AddString("alpha-over");
+	key.AddInt(linear ? 1 : 0);
+	for (int i = 0; i < IMG_NUMBER; i++) {
+		if (!cache.AddInput(key, names[i]))
+			return false;
+		key.AddInt(sprite[i].opacity);
+		key.AddInt(sprite[i].x);
+		key.AddInt(sprite[i].y);
+		key.AddInt((int)sprite[i].mode);
+	}
+	return true;
 }
 
 void ChangeAlphaVal(Sprite& sprite, float alpha) {
+	sprite.opacity = static_cast<unsigned char>(alpha);
 	for (int i = 0; i < sprite.w; ++i) {
 		for (int j = 0; j < sprite.h; ++j) {
 			sprite.PixelMap[i][j].a = alpha / 255.0f; // Scale alpha to [0, 1]
 		}
 	}
+	sprite.generation++;
 }
 
-pixel BlendPixel(const pixel& fg, const pixel& bg) {
-	pixel blended;
-	blended.a = fg.a + bg.a * (1 - fg.a);
-	if (blended.a > 0) {
-		blended.r = (fg.r * fg.a + bg.r * bg.a * (1 - fg.a)) / blended.a;
-		blended.g = (fg.g * fg.a + bg.g * bg.a * (1 - fg.a)) / blended.a;
-		blended.b = (fg.b * fg.a + bg.b * bg.a * (1 - fg.a)) / blended.a;
+// True when every layer still has the 8-bit colors it was read with and
+// blends normally, its opacity being uniform; such a stack is
+// composited in 8 bits with tabulated weights and integer arithmetic
+// instead of in floats.
+bool CanBlend8Bit(Sprite sprite[]) {
+	for (int k = 0; k < IMG_NUMBER; ++k) {
+		if (!sprite[k].Bytes || sprite[k].mode != BlendMode::Normal)
+			return false;
 	}
-	else {
-		blended.r = blended.g = blended.b = 0;  // Fully transparent
-	}
-	return blended;
+	return true;
 }
 
-Sprite AlphaBlending(Sprite sprite[]) {
-	Sprite spriteVar; // Start with the first sprite
-	Vector2i outputSize = OutputSize(sprite);
-	spriteVar.w = outputSize.x;
-	spriteVar.h = outputSize.y;
-	AllocMat(spriteVar);
-	for (int i = 0; i < outputSize.x; ++i) {
-		for (int j = 0; j < outputSize.y; ++j) {
-			pixel finalPixel = sprite[0].PixelMap[i][j];
-			for (int k = 1; k < IMG_NUMBER; ++k) {
-				if (i < sprite[k].w && j < sprite[k].h) {
-					finalPixel = BlendPixel(sprite[k].PixelMap[i][j], sprite[0].PixelMap[i][j]);
+// Whether BlendRegion takes the 8-bit path for this stack
+bool UsesBlend8Bit(Sprite sprite[], bool linear) {
+	return !linear && CanBlend8Bit(sprite);
+}
+
+// BlendRegion for such a stack. The colors are rounded to 8 bits after
+// each layer, so they may differ from the float result by one step.
+void BlendRegion8Bit(pixel** target, int targetX, int targetY, Sprite sprite[], Rect roi) {
+	std::vector<RGBApixel> canvas((size_t)roi.w * roi.h, RGBApixel{ 0, 0, 0, 0 });
+	for (int k = 0; k < IMG_NUMBER; ++k) {
+		Rect area = sprite[k].Placement().Intersect(roi);
+		if (area.Empty())
+			continue;
+		OpacityTables tables;
+		MakeOpacityTables(sprite[k].opacity, tables);
+		for (int x = area.x; x < area.x + area.w; ++x) {
+			const RGBApixel* src = sprite[k].Bytes + (size_t)(x - sprite[k].x) * sprite[k].h + (area.y - sprite[k].y);
+			RGBApixel* dst = &canvas[(size_t)(x - roi.x) * roi.h + (area.y - roi.y)];
+			if (k == 0) {
+				for (int j = 0; j < area.h; ++j) {
+					dst[j] = src[j];
+					dst[j].Alpha = sprite[k].opacity;
 				}
+				continue;
 			}
-			spriteVar.PixelMap[i][j] = finalPixel;
+			BlendScanline8(src, dst, area.h, tables);
 		}
 	}
+
+	for (int i = 0; i < roi.w; ++i) {
+		ConvertPixels(&canvas[(size_t)i * roi.h], BMP_BGRA32, target[targetX + i] + targetY, BMP_RGBAf32, roi.h);
+	}
+}
+
+// Composites the canvas pixels of roi into target, where canvas pixel
+// (roi.x + i, roi.y + j) lands on target[targetX + i][targetY + j].
+// The layers are stacked in order, each blended in its own mode onto
+// the result of the ones below it; canvas not covered by any layer
+// stays transparent. Each layer's placement is intersected with roi up
+// front, so the inner loops only visit pixels the layer covers and need
+// no bounds tests. With linear set the colors are decoded from sRGB to
+// linear light before blending and the result is encoded back.
+void BlendRegion(pixel** target, int targetX, int targetY, Sprite sprite[], Rect roi, bool linear) {
+	if (UsesBlend8Bit(sprite, linear)) {
+		BlendRegion8Bit(target, targetX, targetY, sprite, roi);
+		return;
+	}
+	pixel transparent;
+	transparent.a = 0;
+	for (int i = 0; i < roi.w; ++i) {
+		std::fill(target[targetX + i] + targetY, target[targetX + i] + targetY + roi.h, transparent);
+	}
+
+	std::vector<pixel> decoded;
+	for (int k = 0; k < IMG_NUMBER; ++k) {
+		Rect area = sprite[k].Placement().Intersect(roi);
+		if (area.Empty())
+			continue;
+		ScanlineBlender blend = GetScanlineBlender(sprite[k].mode);
+		for (int x = area.x; x < area.x + area.w; ++x) {
+			const pixel* src = sprite[k].PixelMap[x - sprite[k].x] + (area.y - sprite[k].y);
+			pixel* dst = target[targetX + x - roi.x] + (targetY + area.y - roi.y);
+			if (k == 0) {
+				std::copy(src, src + area.h, dst);
+				if (linear)
+					DecodeSrgbScanline(dst, area.h);
+				continue;
+			}
+			if (linear) {
+				decoded.assign(src, src + area.h);
+				DecodeSrgbScanline(decoded.data(), area.h);
+				src = decoded.data();
+			}
+			blend(src, dst, area.h);
+		}
+	}
+
+	if (linear) {
+		for (int i = 0; i < roi.w; ++i) {
+			EncodeSrgbScanline(target[targetX + i] + targetY, roi.h);
+		}
+	}
+}
+
+// Blends only roi of the canvas; the result is a roi.w x roi.h sprite
+// placed at roi.
+Sprite AlphaBlending(Sprite sprite[], Rect roi, bool linear) {
+	Sprite spriteVar;
+	spriteVar.w = roi.w;
+	spriteVar.h = roi.h;
+	spriteVar.x = roi.x;
+	spriteVar.y = roi.y;
+	AllocMat(spriteVar);
+	BlendRegion(spriteVar.PixelMap, 0, 0, sprite, roi, linear);
 	return spriteVar;
 }
 
-void DrawSprite(pixel** pixelMap, Vector2i outputSize, Sprite sprite[], TextTimer Extra) {
-	for (int i = 0; i < outputSize.x - 1; ++i) {
-		for (int j = 0; j < outputSize.y - 1; ++j) {
-			Color pixelColor = BLACK; // Default color to black
+Sprite AlphaBlending(Sprite sprite[], bool linear) {
+	Vector2i outputSize = OutputSize(sprite);
+	return AlphaBlending(sprite, Rect{ 0, 0, outputSize.x, outputSize.y }, linear);
+}
 
-			pixelColor.r = static_cast<unsigned char>(pixelMap[i][j].r * 255);
-			pixelColor.g = static_cast<unsigned char>(pixelMap[i][j].g * 255);
-			pixelColor.b = static_cast<unsigned char>(pixelMap[i][j].b * 255);
-			pixelColor.a = static_cast<unsigned char>(pixelMap[i][j].a * 255);
+static_assert(sizeof(Color) == 4, "Color must be laid out as BMP_RGBA8");
 
-			DrawPixel(i, j, pixelColor);
+// pixelMap holds the pixels of region, which is drawn at its place on
+// the canvas; the canvas' last row and column are never drawn.
+void DrawSprite(pixel** pixelMap, Rect region, Vector2i outputSize, Sprite sprite[], TextTimer Extra) {
+	Rect visible = region.Intersect(Rect{ 0, 0, outputSize.x - 1, outputSize.y - 1 });
+	std::vector<Color> colors(std::max(visible.h, 0));
+	for (int i = visible.x; i < visible.x + visible.w; ++i) {
+		ConvertPixels(pixelMap[i - region.x] + (visible.y - region.y), BMP_RGBAf32, colors.data(), BMP_RGBA8, visible.h);
+		for (int j = 0; j < visible.h; ++j) {
+			DrawPixel(i, visible.y + j, colors[j]);
 		}
 	}
 	if (Extra.time != 0) {
@@ -346,17 +552,45 @@ void DrawSprite(pixel** pixelMap, Vector2i outputSize, Sprite sprite[], TextTime
 		DrawText(Extra.str, outputSize.x - 550, outputSize.y - 50, 20, RED);
 	}
 	for (int i = 0; i < IMG_NUMBER; i++) {
-		DrawText(TextFormat("Sprite %i: \n width: %i\n height: %i\n alpha value: %f", i, sprite[i].w, sprite[i].h, sprite[i].PixelMap[1][1].a * 255), (int)outputSize.x - 100, 60 * i + 10, 10, WHITE);
+		DrawText(TextFormat("Sprite %i: \n width: %i\n height: %i\n alpha value: %f\n mode: %s", i, sprite[i].w, sprite[i].h, sprite[i].PixelMap[1][1].a * 255, BlendModeName(sprite[i].mode)), (int)outputSize.x - 100, 70 * i + 10, 10, WHITE);
 	}
 }
 
-void ScreenOutput(Sprite sprite[], Sprite& finalSprite) {
-	bool img_efx[] = { false/*Black&White B*/,false/*Grayscale G*/,false/*Extra S*/,false/*Sobel Edge Detection E*/ };
+// grade, if loaded, is applied to whatever is shown, after any filter.
+void ScreenOutput(Sprite sprite[], Sprite& finalSprite, bool& blended, bool& linear, const Lut3D& grade) {
+	bool img_efx[] = { false/*Black&White B*/,false/*Grayscale G*/,false/*Extra S*/,false/*Sobel Edge Detection E*/,false/*Blur U*/,false/*Sharpen H*/,false/*Emboss O*/,false/*Otsu B&W T*/,false/*Canny Edge Detection C*/,false/*Cleaned B&W K*/,false/*Components N*/ };
+	bool graded = false;
+	CannyWorkspace canny;
 	TextTimer Extra;
 	unsigned char img_num = 0;
 	unsigned char alpha_val = 100;
 	Vector2i outputSize = OutputSize(sprite);
 
+	Rect canvas{ 0, 0, outputSize.x, outputSize.y };
+
+	// Once finalSprite holds a blended canvas, a change to one layer only
+	// re-blends the part of the canvas that layer covers, in place. The
+	// 8-bit and float paths may differ by a step, so when a change moves
+	// the stack from one to the other the whole canvas is blended again,
+	// and the canvas never mixes the two.
+	bool canvas8Bit = false;
+	auto reblend = [&](Rect changed) {
+		bool use8Bit = UsesBlend8Bit(sprite, linear);
+		if (!blended) {
+			finalSprite = AlphaBlending(sprite, linear);
+			blended = true;
+			canvas8Bit = use8Bit;
+			return;
+		}
+		if (use8Bit != canvas8Bit) {
+			changed = canvas;
+			canvas8Bit = use8Bit;
+		}
+		changed = changed.Intersect(canvas);
+		BlendRegion(finalSprite.PixelMap, changed.x, changed.y, sprite, changed, linear);
+		finalSprite.generation++;
+	};
+
 	InitWindow(outputSize.x, outputSize.y, "Raylib Program");
 	SetTargetFPS(60);
 
@@ -377,20 +611,36 @@ void ScreenOutput(Sprite sprite[], Sprite& finalSprite) {
 		if (IsKeyDown(KEY_UP) && alpha_val < 255) {
 			alpha_val = std::min(alpha_val + 15, 255);
 			ChangeAlphaVal(sprite[img_num], alpha_val);
-			finalSprite = AlphaBlending(sprite);
+			reblend(sprite[img_num].Placement());
 			Extra = TextTimer{ TextFormat("Image %i alpha value has been changed to: %i", (int)img_num, (int)alpha_val), 100 };
 			actionOccurred = true;
 		}
 		else if (IsKeyDown(KEY_DOWN) && alpha_val > 0) {
 			alpha_val = std::max(alpha_val - 15, 0);
 			ChangeAlphaVal(sprite[img_num], alpha_val);
-			finalSprite = AlphaBlending(sprite);
+			reblend(sprite[img_num].Placement());
 			Extra = TextTimer{ TextFormat("Image %i alpha value has been changed to: %i", (int)img_num, (int)alpha_val), 100 };
 			actionOccurred = true;
 		}
 
+		if (IsKeyPressed(KEY_M)) {
+			int next = ((int)sprite[img_num].mode + 1) % (int)BlendMode::Count;
+			sprite[img_num].mode = (BlendMode)next;
+			reblend(sprite[img_num].Placement());
+			Extra = TextTimer{ TextFormat("Image %i blend mode has been changed to: %s", (int)img_num, BlendModeName(sprite[img_num].mode)), 100 };
+			actionOccurred = true;
+		}
+
+		if (IsKeyPressed(KEY_L)) {
+			linear = !linear;
+			if (blended)
+				reblend(canvas);
+			Extra = TextTimer{ linear ? "Linear-light blending has been enabled" : "Linear-light blending has been disabled", 100 };
+			actionOccurred = true;
+		}
+
 		if (IsKeyDown(KEY_A)) {
-			finalSprite = AlphaBlending(sprite);
+			reblend(canvas);
 			Extra = TextTimer{ TextFormat("Alpha (normal) blending has been applied"), 100 };
 			actionOccurred = true;
 		}
@@ -414,6 +664,46 @@ void ScreenOutput(Sprite sprite[], Sprite& finalSprite) {
 			Extra = TextTimer{ (img_efx[3]) ? "Sobel Edge Detectionfilter has been enabled" : "Sobel Edge Detection filter has been disabled", 100 };
 			actionOccurred = true;
 		}
+		if (IsKeyDown(KEY_U)) {
+			img_efx[4] = !img_efx[4];
+			Extra = TextTimer{ (img_efx[4]) ? "Blur filter has been enabled" : "Blur filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_H)) {
+			img_efx[5] = !img_efx[5];
+			Extra = TextTimer{ (img_efx[5]) ? "Sharpen filter has been enabled" : "Sharpen filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_O)) {
+			img_efx[6] = !img_efx[6];
+			Extra = TextTimer{ (img_efx[6]) ? "Emboss filter has been enabled" : "Emboss filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_T)) {
+			img_efx[7] = !img_efx[7];
+			Extra = TextTimer{ (img_efx[7]) ? "Otsu B&W filter has been enabled" : "Otsu B&W filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_C)) {
+			img_efx[8] = !img_efx[8];
+			Extra = TextTimer{ (img_efx[8]) ? "Canny Edge Detection filter has been enabled" : "Canny Edge Detection filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_K)) {
+			img_efx[9] = !img_efx[9];
+			Extra = TextTimer{ (img_efx[9]) ? "Cleaned B&W filter has been enabled" : "Cleaned B&W filter has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_D)) {
+			graded = !graded && !grade.Empty();
+			Extra = TextTimer{ grade.Empty() ? "No grade has been loaded" : (graded) ? "Grade has been enabled" : "Grade has been disabled", 100 };
+			actionOccurred = true;
+		}
+		if (IsKeyDown(KEY_N)) {
+			img_efx[10] = !img_efx[10];
+			Extra = TextTimer{ (img_efx[10]) ? "Components filter has been enabled" : "Components filter has been disabled", 100 };
+			actionOccurred = true;
+		}
 		// Reset the text if no action occurred
 		if (!actionOccurred && Extra.time == 0) {
 			Extra.str = "";  // Reset to an empty string
@@ -422,20 +712,58 @@ void ScreenOutput(Sprite sprite[], Sprite& finalSprite) {
 		BeginDrawing();
 		ClearBackground(BLACK);
 
-		if (img_efx[0]) {
-			DrawSprite(finalSprite.ToBW(), outputSize, sprite, Extra);
+		// only the visible part of the composite is filtered and drawn
+		Rect visible = finalSprite.Placement().Intersect(Rect{ 0, 0, outputSize.x - 1, outputSize.y - 1 });
+		Rect region{ visible.x - finalSprite.x, visible.y - finalSprite.y, visible.w, visible.h };
+		pixel** filtered = nullptr;
+		if (img_efx[0] && img_efx[1]) {
+			filtered = finalSprite.ToGrayscaleBW(region);
+		}
+		else if (img_efx[0]) {
+			filtered = finalSprite.ToBW(region);
 		}
 		else if (img_efx[1]) {
-			DrawSprite(finalSprite.ToGrayscale(), outputSize, sprite, Extra);
+			filtered = finalSprite.ToGrayscale(region);
 		}
 		else if (img_efx[2]) {
-			DrawSprite(finalSprite.ToRandFilter(), outputSize, sprite, Extra);
+			filtered = finalSprite.ToRandFilter(region);
 		}
 		else if (img_efx[3]) {
-			DrawSprite(finalSprite.toSobelEdgeDetection(), outputSize, sprite, Extra);
+			filtered = finalSprite.toSobelEdgeDetection(region);
+		}
+		else if (img_efx[4]) {
+			filtered = finalSprite.ToBlur(region);
+		}
+		else if (img_efx[5]) {
+			filtered = finalSprite.ToSharpen(region);
+		}
+		else if (img_efx[6]) {
+			filtered = finalSprite.ToEmboss(region);
+		}
+		else if (img_efx[7]) {
+			filtered = finalSprite.ToOtsuBW(region);
+		}
+		else if (img_efx[8]) {
+			filtered = finalSprite.ToCanny(region, canny);
+		}
+		else if (img_efx[9]) {
+			filtered = finalSprite.ToCleanBW(region);
+		}
+		else if (img_efx[10]) {
+			filtered = finalSprite.ToComponents(region);
+		}
+		if (graded) {
+			if (filtered)
+				Evaluate(Grade(Layer(filtered, Rect{ 0, 0, region.w, region.h }), grade), filtered, 0, 0, region.w, region.h);
+			else
+				filtered = Render(Grade(Layer(finalSprite.PixelMap, region), grade), region.w, region.h);
+		}
+		if (filtered) {
+			DrawSprite(filtered, visible, outputSize, sprite, Extra);
+			FreePixelMap(filtered, region.w);
 		}
 		else {
-			DrawSprite(finalSprite.PixelMap, outputSize, sprite, Extra);
+			DrawSprite(finalSprite.PixelMap, finalSprite.Placement(), outputSize, sprite, Extra);
 		}
 
 		EndDrawing();
@@ -447,35 +775,37 @@ void ScreenOutput(Sprite sprite[], Sprite& finalSprite) {
 int main() {
 	Sprite sprite[IMG_NUMBER];
 	Sprite outputSprite;
-	BMP imageFile[IMG_NUMBER];
-	if (!imageFile[0].ReadFromFile("Marbles.bmp")) {
-		std::cerr << "Error: Could not open the image file Dog1.bmp!" << std::endl;
-		return 1;
-	}
-	if (!imageFile[1].ReadFromFile("sample1.bmp")) {
-		std::cerr << TextFormat("Error: Could not open the image file Flower%i.bmp", 1) << std::endl;
+	const char* imageNames[IMG_NUMBER] = { "Marbles.bmp", "sample1.bmp", "sample3.bmp" };
+	std::shared_ptr<const BMP> imageFile[IMG_NUMBER];
+	BMPCache imageCache(256 << 20);
+	if (!LoadImages(imageCache, imageNames, imageFile))
 		return 1;
-	}
-	if (!imageFile[2].ReadFromFile("sample3.bmp")) {
-		std::cerr << TextFormat("Error: Could not open the image file Flower%i.bmp", 1) << std::endl;
-		return 1;
-	}
-	//for (int i = 1; i < IMG_NUMBER; i++)
-	//	if (!imageFile[i].ReadFromFile(TextFormat("Flower%i.bmp", i))) {
-	//		std::cerr << TextFormat("Error: Could not open the image file Flower%i.bmp", i) << std::endl;
-	//		return 1;
-	//	}
 
 	for (int i = 0; i < IMG_NUMBER; i++) {
-		sprite[i].w = imageFile[i].TellWidth();
-		sprite[i].h = imageFile[i].TellHeight();
+		sprite[i].w = imageFile[i]->TellWidth();
+		sprite[i].h = imageFile[i]->TellHeight();
 
 		AllocMat(sprite[i]);
-		ReadMat(sprite[i], imageFile[i]);
+		ReadMat(sprite[i], *imageFile[i]);
 	}
 
 	outputSprite = sprite[0];
-	ScreenOutput(sprite, outputSprite);
-	WriteFile(outputSprite);
+	bool blended = false;
+	bool linear = false;
+	// an optional grade for the display; without the file there is none
+	Lut3D grade;
+	if (std::ifstream("Grade.cube"))
+		LoadCubeFile("Grade.cube", grade);
+	ScreenOutput(sprite, outputSprite, blended, linear, grade);
+
+	BMPResultCache resultCache("MARBLES2.cache", 512 << 20);
+	BMPResultKey key;
+	bool keyed = OutputKey(resultCache, imageNames, sprite, blended, linear, key);
+	if (!keyed || !resultCache.Fetch(key, "MARBLES2.bmp")) {
+		// only a file this run wrote, under a complete key, may go into
+		// the cache
+		if (WriteFile(outputSprite) && keyed)
+			resultCache.Store(key, "MARBLES2.bmp");
+	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "Integral.h"
+#include "EasyBMP_Parallel.h"
+
+namespace {
+
+const int MIN_BAND = 64;
+
+}
+
+SummedArea::SummedArea(const Plane& plane) : w(plane.w), h(plane.h),
+	sum((size_t)(plane.w + 1) * (plane.h + 1)), sumSq((size_t)(plane.w + 1) * (plane.h + 1)) {
+	size_t stride = (size_t)h + 1;
+
+	// down each column on its own...
+	EasyBMPparallelFor(0, w, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			const float* column = plane.Column(x);
+			double* s = &sum[(x + 1) * stride];
+			double* s2 = &sumSq[(x + 1) * stride];
+			double running = 0, runningSq = 0;
+			for (int y = 0; y < h; ++y) {
+				running += column[y];
+				runningSq += (double)column[y] * column[y];
+				s[y + 1] = running;
+				s2[y + 1] = runningSq;
+			}
+		}
+	});
+
+	// ...then across, each band of rows adding whole columns together
+	EasyBMPparallelFor(0, h, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = 1; x < w; ++x) {
+			const double* previous = &sum[x * stride + 1];
+			const double* previousSq = &sumSq[x * stride + 1];
+			double* s = &sum[(x + 1) * stride + 1];
+			double* s2 = &sumSq[(x + 1) * stride + 1];
+			for (int y = begin; y < end; ++y) {
+				s[y] += previous[y];
+				s2[y] += previousSq[y];
+			}
+		}
+	});
+}
+
+Mask LocalMeanThreshold(const Plane& value, Rect roi, int radius, float bias) {
+	SummedArea table(value);
+	Rect plane{ 0, 0, value.w, value.h };
+	Mask below(roi.w, roi.h);
+	double keep = 1.0 - bias;
+	EasyBMPparallelFor(0, roi.w, 0, MIN_BAND, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			const float* column = value.Column(roi.x + x);
+			uint64_t* out = below.Column(x);
+			for (int y = 0; y < roi.h; ++y) {
+				Rect window = Rect{ roi.x + x, roi.y + y, 1, 1 }.Expand(radius).Intersect(plane);
+				// compared without dividing: value * area <= keep * sum
+				if ((double)column[roi.y + y] * window.w * window.h <= keep * table.Sum(window))
+					out[y >> 6] |= (uint64_t)1 << (y & 63);
+			}
+		}
+	});
+	return below;
+}
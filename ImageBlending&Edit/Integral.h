@@ -0,0 +1,44 @@
+#pragma once
+#include "Convolve.h"
+#include "Mask.h"
+
+// Summed-area table of a plane: the sum, and the sum of squares, of any
+// rectangle in four lookups, whatever its size. Entry (x, y) covers the
+// pixels left of x and above y, so row and column 0 are zero; entries
+// are kept by column, like the plane, and in double so that the sums of
+// large images stay exact to well below a pixel value.
+struct SummedArea {
+	int w, h; // of the plane
+	std::vector<double> sum, sumSq;
+
+	// Builds the table with the work split into bands of columns, then of
+	// rows.
+	explicit SummedArea(const Plane& plane);
+
+	double Sum(Rect r) const {
+		return Corners(sum, r);
+	}
+	double SumSq(Rect r) const {
+		return Corners(sumSq, r);
+	}
+	// Of a non-empty rectangle inside the plane
+	double Mean(Rect r) const {
+		return Sum(r) / ((double)r.w * r.h);
+	}
+	double Variance(Rect r) const {
+		double mean = Mean(r);
+		return std::max(SumSq(r) / ((double)r.w * r.h) - mean * mean, 0.0);
+	}
+
+private:
+	double Corners(const std::vector<double>& table, Rect r) const {
+		size_t left = (size_t)r.x * (h + 1), right = (size_t)(r.x + r.w) * (h + 1);
+		return table[right + r.y + r.h] - table[left + r.y + r.h] - table[right + r.y] + table[left + r.y];
+	}
+};
+
+// Local-mean threshold (Bradley and Roth): below(x, y) is true where the
+// value is at most (1 - bias) times the mean over the window reaching
+// radius pixels around (x, y), clipped to the plane. Evaluated over
+// region roi of value, into a roi.w x roi.h mask set where below.
+Mask LocalMeanThreshold(const Plane& value, Rect roi, int radius, float bias);
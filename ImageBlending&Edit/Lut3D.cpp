@@ -0,0 +1,108 @@
+#include "Lut3D.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Parses count floats from text; false unless all are there and nothing
+// but space follows.
+bool ParseFloats(const char* text, float* values, int count) {
+	for (int i = 0; i < count; ++i) {
+		char* end;
+		values[i] = std::strtof(text, &end);
+		if (end == text)
+			return false;
+		text = end;
+	}
+	while (*text == ' ' || *text == '\t' || *text == '\r') {
+		++text;
+	}
+	return *text == '\0';
+}
+
+bool StartsWith(const std::string& line, const char* keyword) {
+	size_t n = std::strlen(keyword);
+	return line.compare(0, n, keyword) == 0 && (line.size() == n || line[n] == ' ' || line[n] == '\t');
+}
+
+}
+
+bool LoadCubeFile(const char* fileName, Lut3D& lut) {
+	std::ifstream file(fileName);
+	if (!file) {
+		std::cerr << "Could not open the LUT file " << fileName << "." << std::endl;
+		return false;
+	}
+
+	Lut3D loaded;
+	size_t points = 0;
+	std::string line;
+	int lineNumber = 0;
+	auto fail = [&](const char* problem) {
+		std::cerr << fileName << ", line " << lineNumber << ": " << problem << std::endl;
+		return false;
+	};
+	while (std::getline(file, line)) {
+		++lineNumber;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+		line.erase(0, first);
+
+		if (StartsWith(line, "TITLE"))
+			continue;
+		if (StartsWith(line, "LUT_1D_SIZE"))
+			return fail("1D LUTs are not supported.");
+		if (StartsWith(line, "LUT_3D_SIZE")) {
+			int size = std::atoi(line.c_str() + 11);
+			if (size < 2 || size > 256)
+				return fail("LUT_3D_SIZE must be from 2 to 256.");
+			loaded.size = size;
+			loaded.table.assign(4 * (size_t)size * size * size, 0.0f);
+			continue;
+		}
+		if (StartsWith(line, "DOMAIN_MIN")) {
+			if (!ParseFloats(line.c_str() + 10, loaded.domainMin, 3))
+				return fail("DOMAIN_MIN needs three numbers.");
+			continue;
+		}
+		if (StartsWith(line, "DOMAIN_MAX")) {
+			if (!ParseFloats(line.c_str() + 10, loaded.domainMax, 3))
+				return fail("DOMAIN_MAX needs three numbers.");
+			continue;
+		}
+		if (StartsWith(line, "LUT_3D_INPUT_RANGE")) {
+			float range[2];
+			if (!ParseFloats(line.c_str() + 18, range, 2))
+				return fail("LUT_3D_INPUT_RANGE needs two numbers.");
+			for (int c = 0; c < 3; ++c) {
+				loaded.domainMin[c] = range[0];
+				loaded.domainMax[c] = range[1];
+			}
+			continue;
+		}
+
+		// anything else is a point
+		if (loaded.size == 0)
+			return fail("Points come before LUT_3D_SIZE.");
+		if (points == loaded.table.size() / 4)
+			return fail("There are more points than LUT_3D_SIZE allows.");
+		if (!ParseFloats(line.c_str(), &loaded.table[4 * points], 3))
+			return fail("A point needs three numbers.");
+		++points;
+	}
+
+	if (loaded.size == 0)
+		return fail("There is no LUT_3D_SIZE.");
+	if (points != loaded.table.size() / 4)
+		return fail("There are fewer points than LUT_3D_SIZE needs.");
+	for (int c = 0; c < 3; ++c) {
+		if (!(loaded.domainMax[c] > loaded.domainMin[c]))
+			return fail("The domain is empty.");
+	}
+	lut = std::move(loaded);
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "Pixel.h"
+#include "Simd.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// A 3D color lookup table, such as a grade exported as a .cube file: the
+// output color at size^3 lattice points spread evenly over the domain,
+// red varying fastest. Colors between the points are interpolated
+// tetrahedrally: the lattice cell is cut into six tetrahedra along its
+// diagonal and the four corners of the one holding the color are
+// weighted, which needs four lookups rather than trilinear's eight and
+// keeps the gray axis exact.
+struct Lut3D {
+	int size; // 0 when nothing is loaded
+	float domainMin[3], domainMax[3];
+	std::vector<float> table; // r, g, b and a zero per point, so a point is one SSE load
+
+	Lut3D() : size(0), domainMin{ 0, 0, 0 }, domainMax{ 1, 1, 1 } {}
+
+	bool Empty() const {
+		return size == 0;
+	}
+
+	// The graded color of p; alpha is kept. Colors outside the domain take
+	// the color at its edge.
+	pixel Apply(const pixel& p) const {
+		int n = size - 1;
+		float in[3] = { p.r, p.g, p.b };
+		int base = 0;
+		int step[3] = { 4, 4 * size, 4 * size * size };
+		float f[3];
+		for (int c = 0; c < 3; ++c) {
+			float x = (in[c] - domainMin[c]) / (domainMax[c] - domainMin[c]) * n;
+			if (!(x > 0))
+				x = 0;
+			if (x > n)
+				x = (float)n;
+			int i = std::min((int)x, n - 1);
+			f[c] = x - i;
+			base += i * step[c];
+		}
+
+		// order the axes by their fraction, largest first: the tetrahedron
+		// runs from the cell's first corner along those axes in turn
+		int a = 0, b = 1, c = 2;
+		if (f[a] < f[b])
+			std::swap(a, b);
+		if (f[b] < f[c])
+			std::swap(b, c);
+		if (f[a] < f[b])
+			std::swap(a, b);
+		const float* v0 = &table[base];
+		const float* v1 = v0 + step[a];
+		const float* v2 = v1 + step[b];
+		const float* v3 = v2 + step[c];
+		float w0 = 1 - f[a], w1 = f[a] - f[b], w2 = f[b] - f[c], w3 = f[c];
+
+		pixel out;
+#ifdef SIMD_SSE2
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(w0), _mm_loadu_ps(v0));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w1), _mm_loadu_ps(v1)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w2), _mm_loadu_ps(v2)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w3), _mm_loadu_ps(v3)));
+		_mm_storeu_ps(&out.r, sum);
+#else
+		out.r = w0 * v0[0] + w1 * v1[0] + w2 * v2[0] + w3 * v3[0];
+		out.g = w0 * v0[1] + w1 * v1[1] + w2 * v2[1] + w3 * v3[1];
+		out.b = w0 * v0[2] + w1 * v1[2] + w2 * v2[2] + w3 * v3[2];
+#endif
+		out.a = p.a;
+		return out;
+	}
+};
+
+// Reads a .cube file (LUT_3D_SIZE, DOMAIN_MIN, DOMAIN_MAX and TITLE are
+// understood, LUT_3D_INPUT_RANGE too); on failure says why on std::cerr,
+// returns false and leaves lut as it was.
+bool LoadCubeFile(const char* fileName, Lut3D& lut);
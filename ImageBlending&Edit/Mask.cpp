@@ -0,0 +1,206 @@
+#include "Mask.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+long long Mask::Count() const {
+	long long count = 0;
+	for (uint64_t word : bits) {
+		count += PopCount64(word);
+	}
+	return count;
+}
+
+namespace {
+
+// Transposes the 8 x 8 bit matrix whose row i is byte i of v: bit j of
+// byte i moves to bit i of byte j. Filling byte 7 - i with column i of a
+// mask therefore reverses the bit order within each byte as well, which
+// puts the leftmost pixel in the top bit as a 1-bit BMP row wants.
+uint64_t Transpose8x8(uint64_t v) {
+	uint64_t t = (v ^ (v >> 7)) & 0x00AA00AA00AA00AAULL;
+	v ^= t ^ (t << 7);
+	t = (v ^ (v >> 14)) & 0x0000CCCC0000CCCCULL;
+	v ^= t ^ (t << 14);
+	t = (v ^ (v >> 28)) & 0x00000000F0F0F0F0ULL;
+	v ^= t ^ (t << 28);
+	return v;
+}
+
+// out = op(a, b) over n words; Op works on both uint64_t and __m128i.
+template <class Op>
+void Combine(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n, Op op) {
+	size_t k = 0;
+#ifdef SIMD_SSE2
+	for (; k + 2 <= n; k += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + k));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + k));
+		_mm_storeu_si128((__m128i*)(out + k), op(x, y));
+	}
+#endif
+	for (; k < n; ++k) {
+		out[k] = op(a[k], b[k]);
+	}
+}
+
+struct AndOp {
+	uint64_t operator()(uint64_t x, uint64_t y) const { return x & y; }
+#ifdef SIMD_SSE2
+	__m128i operator()(__m128i x, __m128i y) const { return _mm_and_si128(x, y); }
+#endif
+};
+struct OrOp {
+	uint64_t operator()(uint64_t x, uint64_t y) const { return x | y; }
+#ifdef SIMD_SSE2
+	__m128i operator()(__m128i x, __m128i y) const { return _mm_or_si128(x, y); }
+#endif
+};
+struct XorOp {
+	uint64_t operator()(uint64_t x, uint64_t y) const { return x ^ y; }
+#ifdef SIMD_SSE2
+	__m128i operator()(__m128i x, __m128i y) const { return _mm_xor_si128(x, y); }
+#endif
+};
+
+void Resize(Mask& out, const Mask& like) {
+	if (out.w != like.w || out.h != like.h)
+		out = Mask(like.w, like.h);
+}
+
+}
+
+void MaskAnd(const Mask& a, const Mask& b, Mask& out) {
+	Resize(out, a);
+	Combine(a.bits.data(), b.bits.data(), out.bits.data(), a.bits.size(), AndOp());
+}
+
+void MaskOr(const Mask& a, const Mask& b, Mask& out) {
+	Resize(out, a);
+	Combine(a.bits.data(), b.bits.data(), out.bits.data(), a.bits.size(), OrOp());
+}
+
+void MaskXor(const Mask& a, const Mask& b, Mask& out) {
+	Resize(out, a);
+	Combine(a.bits.data(), b.bits.data(), out.bits.data(), a.bits.size(), XorOp());
+}
+
+void MaskNot(const Mask& a, Mask& out) {
+	Resize(out, a);
+	// xor with a column of all ones, so the bits past h stay 0
+	std::vector<uint64_t> ones(a.words, ~(uint64_t)0);
+	if (a.words > 0)
+		ones.back() = a.LastWordBits();
+	for (int x = 0; x < a.w; ++x) {
+		Combine(a.Column(x), ones.data(), out.Column(x), a.words, XorOp());
+	}
+}
+
+Mask CropMask(const Mask& mask, Rect r) {
+	Mask crop(r.w, r.h);
+	int q = r.y / 64, s = r.y % 64;
+	for (int x = 0; x < r.w; ++x) {
+		const uint64_t* column = mask.Column(r.x + x);
+		uint64_t* out = crop.Column(x);
+		for (int k = 0; k < crop.words; ++k) {
+			uint64_t word = column[q + k] >> s;
+			if (s && q + k + 1 < mask.words)
+				word |= column[q + k + 1] << (64 - s);
+			out[k] = word;
+		}
+		if (crop.words > 0)
+			out[crop.words - 1] &= crop.LastWordBits();
+	}
+	return crop;
+}
+
+void MaskSelect(const Mask& mask, pixel** over, pixel** under, pixel** out) {
+	for (int x = 0; x < mask.w; ++x) {
+		const uint64_t* column = mask.Column(x);
+		for (int k = 0; k < mask.words; ++k) {
+			int y0 = k * 64;
+			int n = std::min(64, mask.h - y0);
+			uint64_t word = column[k];
+			uint64_t all = k + 1 < mask.words ? ~(uint64_t)0 : mask.LastWordBits();
+			if (word == all) {
+				std::copy(over[x] + y0, over[x] + y0 + n, out[x] + y0);
+			}
+			else if (word == 0) {
+				if (out != under)
+					std::copy(under[x] + y0, under[x] + y0 + n, out[x] + y0);
+			}
+			else {
+				for (int j = 0; j < n; ++j) {
+					out[x][y0 + j] = (word >> j) & 1 ? over[x][y0 + j] : under[x][y0 + j];
+				}
+			}
+		}
+	}
+}
+
+pixel** PaintMask(const Mask& mask, pixel set, pixel clear, pixel** alphaFrom, Rect roi) {
+	pixel** map = AllocPixelMap(mask.w, mask.h);
+	for (int x = 0; x < mask.w; ++x) {
+		const uint64_t* column = mask.Column(x);
+		const pixel* alpha = alphaFrom[roi.x + x] + roi.y;
+		pixel* out = map[x];
+		for (int y = 0; y < mask.h; ++y) {
+			out[y] = (column[y >> 6] >> (y & 63)) & 1 ? set : clear;
+			out[y].a = alpha[y].a;
+		}
+	}
+	return map;
+}
+
+bool WriteMaskToFile(const Mask& mask, RGBApixel clear, RGBApixel set, const char* fileName) {
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		std::cerr << "Could not open " << fileName << " for output." << std::endl;
+		return false;
+	}
+	// rows of one bit per pixel, the leftmost in the top bit, padded to 4 bytes
+	int rowBytes = (mask.w + 7) / 8;
+	int stride = (rowBytes + 3) & ~3;
+	BMFH bmfh;
+	bmfh.bfOffBits = 14 + 40 + 2 * 4;
+	bmfh.bfSize = bmfh.bfOffBits + (ebmpDWORD)stride * mask.h;
+	BMIH bmih;
+	bmih.biSize = 40;
+	bmih.biWidth = mask.w;
+	bmih.biHeight = mask.h;
+	bmih.biBitCount = 1;
+	bmih.biSizeImage = (ebmpDWORD)stride * mask.h;
+	bool ok = WriteBMPHeaders(file, bmfh, bmih);
+	ok = ok && fwrite(&clear, 4, 1, file) == 1 && fwrite(&set, 4, 1, file) == 1;
+
+	// The file runs bottom row first, so the words are taken from the
+	// last down; each word of eight neighbouring columns gives 64 rows of
+	// one byte, which are transposed into a band of 64 rows and written.
+	std::vector<unsigned char> band((size_t)64 * stride);
+	for (int word = mask.words - 1; ok && word >= 0; --word) {
+		int rows = std::min(64, mask.h - 64 * word);
+		for (int g = 0; g < rowBytes; ++g) {
+			uint64_t columns[8];
+			for (int i = 0; i < 8; ++i) {
+				columns[i] = 8 * g + i < mask.w ? mask.Column(8 * g + i)[word] : 0;
+			}
+			for (int k = 0; 8 * k < rows; ++k) {
+				uint64_t bytes = 0;
+				for (int i = 0; i < 8; ++i) {
+					bytes |= ((columns[i] >> (8 * k)) & 0xFF) << (8 * (7 - i));
+				}
+				bytes = Transpose8x8(bytes);
+				for (int j = 0; j < 8 && 8 * k + j < rows; ++j) {
+					band[(size_t)(8 * k + j) * stride + g] = (unsigned char)(bytes >> (8 * j));
+				}
+			}
+		}
+		for (int row = rows - 1; ok && row >= 0; --row) {
+			ok = fwrite(&band[(size_t)row * stride], 1, stride, file) == (size_t)stride;
+		}
+	}
+	fclose(file);
+	if (!ok)
+		std::cerr << "Could not write all of " << fileName << "." << std::endl;
+	return ok;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "EasyBMP.h"
+#include "Pixel.h"
+#include <cstdint>
+#include <vector>
+
+// A w x h image of one bit per pixel, for the output of the two-tone
+// filters: 128 times smaller than a pixel map. Stored by column like a
+// pixel map, 64 pixels to a word: pixel (x, y) is bit y % 64 of word
+// y / 64 of column x. The bits past h in each column's last word are
+// always 0, so whole words can be counted and combined.
+struct Mask {
+	int w, h;
+	int words; // per column
+	std::vector<uint64_t> bits;
+
+	Mask() : w(0), h(0), words(0) {}
+	Mask(int w, int h) : w(w), h(h), words((h + 63) / 64), bits((size_t)w * ((h + 63) / 64)) {}
+
+	uint64_t* Column(int x) {
+		return bits.data() + (size_t)x * words;
+	}
+	const uint64_t* Column(int x) const {
+		return bits.data() + (size_t)x * words;
+	}
+	bool Get(int x, int y) const {
+		return (Column(x)[y >> 6] >> (y & 63)) & 1;
+	}
+	void Set(int x, int y, bool value) {
+		uint64_t bit = (uint64_t)1 << (y & 63);
+		if (value)
+			Column(x)[y >> 6] |= bit;
+		else
+			Column(x)[y >> 6] &= ~bit;
+	}
+	// The bits of the last word of a column that lie inside the mask
+	uint64_t LastWordBits() const {
+		return h % 64 ? ((uint64_t)1 << (h % 64)) - 1 : ~(uint64_t)0;
+	}
+	// Number of set pixels
+	long long Count() const;
+};
+
+inline int PopCount64(uint64_t v) {
+#if defined(__GNUC__)
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Index of the lowest set bit; v must not be 0
+inline int CountTrailingZeros64(uint64_t v) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(v);
+#else
+	return PopCount64((v & (0 - v)) - 1);
+#endif
+}
+
+// Bitwise algebra on masks of the same size, a word (or with SSE2 two)
+// at a time; out may be one of the inputs.
+void MaskAnd(const Mask& a, const Mask& b, Mask& out);
+void MaskOr(const Mask& a, const Mask& b, Mask& out);
+void MaskXor(const Mask& a, const Mask& b, Mask& out);
+void MaskNot(const Mask& a, Mask& out);
+
+// Region r of mask, which must lie inside it, as a mask of its own
+Mask CropMask(const Mask& mask, Rect r);
+
+// out[x][y] = set ? over[x][y] : under[x][y] for the mask's pixels, all
+// three maps mask.w x mask.h; out may be under, which then only takes
+// the set pixels. Words of all set or all clear bits are copied as runs.
+void MaskSelect(const Mask& mask, pixel** over, pixel** under, pixel** out);
+
+// A new mask.w x mask.h map: set where the mask is set, clear elsewhere,
+// with the alpha of region roi of alphaFrom (its x, y are the corner).
+pixel** PaintMask(const Mask& mask, pixel set, pixel clear, pixel** alphaFrom, Rect roi);
+
+// Writes a 1-bit BMP whose two palette colors are clear and set,
+// straight from the mask's words; false if the file cannot be written.
+bool WriteMaskToFile(const Mask& mask, RGBApixel clear, RGBApixel set, const char* fileName);
@@ -0,0 +1,162 @@
+#include "Morphology.h"
+#include "EasyBMP_Parallel.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+const int MIN_BAND = 16;
+
+struct AndOp {
+	static uint64_t Apply(uint64_t x, uint64_t y) { return x & y; }
+	static uint64_t Identity() { return ~(uint64_t)0; }
+};
+struct OrOp {
+	static uint64_t Apply(uint64_t x, uint64_t y) { return x | y; }
+	static uint64_t Identity() { return 0; }
+};
+
+// out bit i = in bit (i + s), s >= 0, for out.size() words; bits read past
+// the end of in are fill.
+void ShiftDown(const std::vector<uint64_t>& in, int s, uint64_t fill, std::vector<uint64_t>& out) {
+	size_t q = (size_t)s / 64;
+	int r = s % 64;
+	auto word = [&](size_t k) { return k < in.size() ? in[k] : fill; };
+	for (size_t k = 0; k < out.size(); ++k) {
+		uint64_t low = word(k + q);
+		out[k] = r ? (low >> r) | (word(k + q + 1) << (64 - r)) : low;
+	}
+}
+
+// Down each column: out bit y = Op over in bits y - ry .. y + ry
+template <class Op>
+void AlongColumns(const Mask& in, Mask& out, int ry) {
+	if (ry == 0 || in.words == 0) {
+		if (&out != &in)
+			out = in;
+		return;
+	}
+	Mask result(in.w, in.h);
+	int length = 2 * ry + 1;
+	// enough identity words either side that the window never reads past them
+	int pad = ry / 64 + 1;
+	int n = in.words + 2 * pad;
+	uint64_t tail = in.LastWordBits();
+	EasyBMPparallelFor(0, in.w, 0, MIN_BAND, [&](int begin, int end) {
+		std::vector<uint64_t> run(n), shifted(n);
+		for (int x = begin; x < end; ++x) {
+			std::fill(run.begin(), run.end(), Op::Identity());
+			const uint64_t* column = in.Column(x);
+			for (int k = 0; k < in.words; ++k) {
+				run[pad + k] = column[k];
+			}
+			run[pad + in.words - 1] = (column[in.words - 1] & tail) | (Op::Identity() & ~tail);
+
+			// run bit i covers bits i .. i + covered - 1; double it up to the
+			// largest power of two in length, then overlap two of those
+			int covered = 1;
+			while (covered * 2 <= length) {
+				ShiftDown(run, covered, Op::Identity(), shifted);
+				for (int k = 0; k < n; ++k) {
+					run[k] = Op::Apply(run[k], shifted[k]);
+				}
+				covered *= 2;
+			}
+			if (covered < length) {
+				ShiftDown(run, length - covered, Op::Identity(), shifted);
+				for (int k = 0; k < n; ++k) {
+					run[k] = Op::Apply(run[k], shifted[k]);
+				}
+			}
+
+			// pixel y is the window starting at padded bit pad * 64 + y - ry
+			ShiftDown(run, pad * 64 - ry, Op::Identity(), shifted);
+			uint64_t* target = result.Column(x);
+			for (int k = 0; k < in.words; ++k) {
+				target[k] = shifted[k];
+			}
+			target[in.words - 1] &= tail;
+		}
+	});
+	out = std::move(result);
+}
+
+// Across the columns, van Herk/Gil-Werman: the padded columns are cut into
+// blocks of 2 rx + 1; within each block ahead[i] runs Op from the block's
+// start to i and behind[i] from i to the block's end, so any window of
+// that length is behind at its first column with ahead at its last.
+template <class Op>
+void AlongRows(const Mask& in, Mask& out, int rx) {
+	if (rx == 0 || in.words == 0) {
+		if (&out != &in)
+			out = in;
+		return;
+	}
+	Mask result(in.w, in.h);
+	int length = 2 * rx + 1;
+	int padded = in.w + 2 * rx;
+	int blocks = (padded + length - 1) / length;
+	int total = blocks * length;
+	auto column = [&](int i) -> const uint64_t* {
+		int x = i - rx;
+		return x >= 0 && x < in.w ? in.Column(x) : nullptr;
+	};
+	// bands of word rows, so each band walks every column but writes its
+	// own words only
+	EasyBMPparallelFor(0, in.words, 0, [&](int begin, int end) {
+		int rows = end - begin;
+		std::vector<uint64_t> ahead((size_t)total * rows), behind((size_t)total * rows);
+		for (int i = 0; i < total; ++i) {
+			const uint64_t* source = column(i);
+			uint64_t* a = &ahead[(size_t)i * rows];
+			for (int k = 0; k < rows; ++k) {
+				uint64_t v = source ? source[begin + k] : Op::Identity();
+				a[k] = i % length ? Op::Apply(a[k - rows], v) : v;
+			}
+		}
+		for (int i = total - 1; i >= 0; --i) {
+			const uint64_t* source = column(i);
+			uint64_t* b = &behind[(size_t)i * rows];
+			for (int k = 0; k < rows; ++k) {
+				uint64_t v = source ? source[begin + k] : Op::Identity();
+				b[k] = (i + 1) % length ? Op::Apply(b[k + rows], v) : v;
+			}
+		}
+		for (int x = 0; x < in.w; ++x) {
+			// the window of x covers padded columns x .. x + 2 rx
+			const uint64_t* b = &behind[(size_t)x * rows];
+			const uint64_t* a = &ahead[(size_t)(x + 2 * rx) * rows];
+			uint64_t* target = result.Column(x) + begin;
+			for (int k = 0; k < rows; ++k) {
+				target[k] = Op::Apply(b[k], a[k]);
+			}
+		}
+	});
+	uint64_t tail = in.LastWordBits();
+	for (int x = 0; x < in.w; ++x) {
+		result.Column(x)[in.words - 1] &= tail;
+	}
+	out = std::move(result);
+}
+
+}
+
+void ErodeMask(const Mask& in, Mask& out, int rx, int ry) {
+	AlongRows<AndOp>(in, out, rx);
+	AlongColumns<AndOp>(out, out, ry);
+}
+
+void DilateMask(const Mask& in, Mask& out, int rx, int ry) {
+	AlongRows<OrOp>(in, out, rx);
+	AlongColumns<OrOp>(out, out, ry);
+}
+
+void OpenMask(const Mask& in, Mask& out, int rx, int ry) {
+	ErodeMask(in, out, rx, ry);
+	DilateMask(out, out, rx, ry);
+}
+
+void CloseMask(const Mask& in, Mask& out, int rx, int ry) {
+	DilateMask(in, out, rx, ry);
+	ErodeMask(out, out, rx, ry);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "Mask.h"
+
+// Binary morphology on masks with a rectangle reaching rx columns and ry
+// rows each way from its centre, (2 rx + 1) x (2 ry + 1) in all. Beyond
+// the mask's edge pixels count as set when eroding and clear when
+// dilating, so the edge of the image neither eats into shapes nor grows
+// them.
+//
+// Across, whole columns of words are combined with the van Herk/Gil-Werman
+// method, three operations per word whatever rx is. Down, the packed bits
+// of a column are combined with shifted copies of themselves, doubling the
+// run covered each time, so ry costs log2(2 ry + 1) operations per word.
+// out may be in.
+void ErodeMask(const Mask& in, Mask& out, int rx, int ry);
+void DilateMask(const Mask& in, Mask& out, int rx, int ry);
+
+// Erosion then dilation: removes specks smaller than the rectangle
+void OpenMask(const Mask& in, Mask& out, int rx, int ry);
+// Dilation then erosion: fills holes and gaps smaller than the rectangle
+void CloseMask(const Mask& in, Mask& out, int rx, int ry);
@@ -0,0 +1,35 @@
+#include "Pixel.h"
+#include <iostream>
+#include <new>
+#include <cstdlib>
+
+pixel** AllocPixelMap(int w, int h) {
+	pixel** pixelMap = new(std::nothrow) pixel * [w];
+	if (!pixelMap) {
+		std::cerr << "Memory allocation failed for PixelMap." << std::endl;
+		exit(1);
+	}
+
+	for (int i = 0; i < w; ++i) {
+		pixelMap[i] = new(std::nothrow) pixel[h];
+		if (!pixelMap[i]) {
+			std::cerr << "Memory allocation failed for PixelMap row." << std::endl;
+			// Cleanup previously allocated memory before exiting
+			for (int k = 0; k < i; ++k) {
+				delete[] pixelMap[k];
+			}
+			delete[] pixelMap;
+			exit(1);
+		}
+	}
+	return pixelMap;
+}
+
+void FreePixelMap(pixel** pixelMap, int w) {
+	if (!pixelMap)
+		return;
+	for (int i = 0; i < w; ++i) {
+		delete[] pixelMap[i];
+	}
+	delete[] pixelMap;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <algorithm>
+
+// A rectangle of pixels: x, y is the top-left corner, w, h the size.
+struct Rect {
+	int x, y, w, h;
+
+	bool Empty() const {
+		return w <= 0 || h <= 0;
+	}
+	Rect Intersect(const Rect& other) const {
+		int left = std::max(x, other.x);
+		int top = std::max(y, other.y);
+		int right = std::min(x + w, other.x + other.w);
+		int bottom = std::min(y + h, other.y + other.h);
+		return Rect{ left, top, std::max(right - left, 0), std::max(bottom - top, 0) };
+	}
+	Rect Expand(int by) const {
+		return Rect{ x - by, y - by, w + 2 * by, h + 2 * by };
+	}
+};
+
+struct pixel {
+	float r, g, b, a;
+
+	pixel() : r(0), g(0), b(0), a(1) {} // Default constructor with initialization
+};
+static_assert(sizeof(pixel) == 4 * sizeof(float), "pixel must be laid out as BMP_RGBAf32");
+
+// A w x h map indexed [x][y]; exits if memory runs out.
+pixel** AllocPixelMap(int w, int h);
+void FreePixelMap(pixel** pixelMap, int w);
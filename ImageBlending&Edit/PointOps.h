@@ -0,0 +1,212 @@
+#pragma once
+#include "Pixel.h"
+#include "Lut3D.h"
+#include "EasyBMP_Parallel.h"
+
+// Point operations as expression templates. Each operation is a small
+// struct holding its operands by value, so an expression such as
+//
+//	Threshold(Grayscale(Layer(map, roi)), 0.5f)
+//
+// is one type the compiler inlines into a single kernel: Render runs it
+// in one pass over the region, with no buffer between the steps.
+//
+// Column(x) returns a function of y giving the pixel at (x, y), relative
+// to the region. Whatever depends only on the column (a source column
+// pointer) is worked out there, once, rather than per pixel.
+
+template <class E>
+struct PointExpr {
+	const E& Self() const {
+		return static_cast<const E&>(*this);
+	}
+};
+
+// The pixels of a map, read from region roi.
+struct LayerExpr : PointExpr<LayerExpr> {
+	pixel** map;
+	int x0, y0;
+
+	auto Column(int x) const {
+		const pixel* column = map[x0 + x] + y0;
+		return [column](int y) { return column[y]; };
+	}
+};
+
+inline LayerExpr Layer(pixel** map, Rect roi) {
+	LayerExpr e;
+	e.map = map;
+	e.x0 = roi.x;
+	e.y0 = roi.y;
+	return e;
+}
+
+// Weighted sum of the color channels, written to all three.
+template <class A>
+struct GrayExpr : PointExpr<GrayExpr<A>> {
+	A a;
+	float wr, wg, wb;
+
+	auto Column(int x) const {
+		auto in = a.Column(x);
+		float r = wr, g = wg, b = wb;
+		return [in, r, g, b](int y) {
+			pixel p = in(y);
+			float gray = r * p.r + g * p.g + b * p.b;
+			p.r = p.g = p.b = gray;
+			return p;
+		};
+	}
+};
+
+template <class A>
+GrayExpr<A> Gray(const PointExpr<A>& a, float wr, float wg, float wb) {
+	GrayExpr<A> e;
+	e.a = a.Self();
+	e.wr = wr;
+	e.wg = wg;
+	e.wb = wb;
+	return e;
+}
+
+// Luminance
+template <class A>
+GrayExpr<A> Grayscale(const PointExpr<A>& a) {
+	return Gray(a, 0.299f, 0.587f, 0.114f);
+}
+
+// Two-tone: the red channel (the value of a gray expression) at or below
+// level gives below's color, above it above's; alpha is kept.
+template <class A>
+struct ThresholdExpr : PointExpr<ThresholdExpr<A>> {
+	A a;
+	float level;
+	pixel below, above;
+
+	auto Column(int x) const {
+		auto in = a.Column(x);
+		float t = level;
+		pixel lo = below, hi = above;
+		return [in, t, lo, hi](int y) {
+			pixel p = in(y);
+			pixel q = p.r <= t ? lo : hi;
+			q.a = p.a;
+			return q;
+		};
+	}
+};
+
+template <class A>
+ThresholdExpr<A> Threshold(const PointExpr<A>& a, float level, pixel below, pixel above) {
+	ThresholdExpr<A> e;
+	e.a = a.Self();
+	e.level = level;
+	e.below = below;
+	e.above = above;
+	return e;
+}
+
+// Black and white
+template <class A>
+ThresholdExpr<A> Threshold(const PointExpr<A>& a, float level) {
+	pixel black, white;
+	black.r = black.g = black.b = 0;
+	white.r = white.g = white.b = 1;
+	return Threshold(a, level, black, white);
+}
+
+template <class A>
+struct ScaleAlphaExpr : PointExpr<ScaleAlphaExpr<A>> {
+	A a;
+	float factor;
+
+	auto Column(int x) const {
+		auto in = a.Column(x);
+		float f = factor;
+		return [in, f](int y) {
+			pixel p = in(y);
+			p.a *= f;
+			return p;
+		};
+	}
+};
+
+template <class A>
+ScaleAlphaExpr<A> ScaleAlpha(const PointExpr<A>& a, float factor) {
+	ScaleAlphaExpr<A> e;
+	e.a = a.Self();
+	e.factor = factor;
+	return e;
+}
+
+template <class A>
+struct InvertExpr : PointExpr<InvertExpr<A>> {
+	A a;
+
+	auto Column(int x) const {
+		auto in = a.Column(x);
+		return [in](int y) {
+			pixel p = in(y);
+			p.r = 1 - p.r;
+			p.g = 1 - p.g;
+			p.b = 1 - p.b;
+			return p;
+		};
+	}
+};
+
+template <class A>
+InvertExpr<A> Invert(const PointExpr<A>& a) {
+	InvertExpr<A> e;
+	e.a = a.Self();
+	return e;
+}
+
+// A color grade through a 3D LUT, which must outlive the expression
+template <class A>
+struct GradeExpr : PointExpr<GradeExpr<A>> {
+	A a;
+	const Lut3D* lut;
+
+	auto Column(int x) const {
+		auto in = a.Column(x);
+		const Lut3D* table = lut;
+		return [in, table](int y) { return table->Apply(in(y)); };
+	}
+};
+
+template <class A>
+GradeExpr<A> Grade(const PointExpr<A>& a, const Lut3D& lut) {
+	GradeExpr<A> e;
+	e.a = a.Self();
+	e.lut = &lut;
+	return e;
+}
+
+// The shared driver: evaluates expr into out[outX + x][outY + y] for the
+// w x h region. Maps are stored by column, so the tiles are strips of
+// whole columns, run on as many threads as there are cores, each column
+// run down in one inner loop that has no calls once expr is inlined and
+// that the compiler is free to vectorize. As every pixel depends only on
+// the pixel under it, out may be the map expr reads.
+template <class E>
+void Evaluate(const PointExpr<E>& expr, pixel** out, int outX, int outY, int w, int h) {
+	const E& e = expr.Self();
+	EasyBMPparallelFor(0, w, 0, 64, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			auto in = e.Column(x);
+			pixel* column = out[outX + x] + outY;
+			for (int y = 0; y < h; ++y) {
+				column[y] = in(y);
+			}
+		}
+	});
+}
+
+// Evaluates expr into a new w x h map.
+template <class E>
+pixel** Render(const PointExpr<E>& expr, int w, int h) {
+	pixel** map = AllocPixelMap(w, h);
+	Evaluate(expr, map, 0, 0, w, h);
+	return map;
+}
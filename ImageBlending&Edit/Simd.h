@@ -0,0 +1,9 @@
+#pragma once
+
+// SSE2 is part of every x64 target and of x86 builds that ask for it.
+// Where it is there, SIMD_SSE2 is defined and the intrinsics included;
+// every vector loop keeps a plain one for the other targets.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
@@ -0,0 +1,84 @@
+#include "Srgb.h"
+#include "Simd.h"
+#include <cmath>
+
+namespace {
+
+const int ENCODE_SIZE = 4096;
+
+struct SrgbTables {
+	float decode[256];
+	unsigned char encode[ENCODE_SIZE];
+	float codes[256]; // code / 255, what an encoded channel is stored as
+
+	SrgbTables() {
+		for (int i = 0; i < 256; ++i) {
+			double c = i / 255.0;
+			decode[i] = (float)(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+			codes[i] = i / 255.0f;
+		}
+		for (int i = 0; i < ENCODE_SIZE; ++i) {
+			double l = i / (double)(ENCODE_SIZE - 1);
+			double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+			encode[i] = (unsigned char)(c * 255 + 0.5);
+		}
+	}
+};
+
+const SrgbTables& Tables() {
+	static const SrgbTables tables;
+	return tables;
+}
+
+}
+
+float SrgbToLinear(unsigned char v) {
+	return Tables().decode[v];
+}
+
+unsigned char LinearToSrgb(float v) {
+	v = std::min(std::max(v, 0.0f), 1.0f);
+	return Tables().encode[(int)(v * (ENCODE_SIZE - 1) + 0.5f)];
+}
+
+// Both scanline loops compute the table indices of a pixel's four
+// channels at once (scale, clamp, round) and then look up r, g and b.
+
+void DecodeSrgbScanline(pixel* p, int n) {
+	const SrgbTables& t = Tables();
+	for (int j = 0; j < n; ++j) {
+		int index[4];
+#ifdef SIMD_SSE2
+		__m128 v = _mm_loadu_ps(&p[j].r);
+		v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_setzero_ps()), _mm_set1_ps(255.0f));
+		_mm_storeu_si128((__m128i*)index, _mm_cvtps_epi32(v));
+#else
+		index[0] = (int)(std::min(std::max(p[j].r, 0.0f), 1.0f) * 255 + 0.5f);
+		index[1] = (int)(std::min(std::max(p[j].g, 0.0f), 1.0f) * 255 + 0.5f);
+		index[2] = (int)(std::min(std::max(p[j].b, 0.0f), 1.0f) * 255 + 0.5f);
+#endif
+		p[j].r = t.decode[index[0]];
+		p[j].g = t.decode[index[1]];
+		p[j].b = t.decode[index[2]];
+	}
+}
+
+void EncodeSrgbScanline(pixel* p, int n) {
+	const SrgbTables& t = Tables();
+	const float scale = ENCODE_SIZE - 1;
+	for (int j = 0; j < n; ++j) {
+		int index[4];
+#ifdef SIMD_SSE2
+		__m128 v = _mm_loadu_ps(&p[j].r);
+		v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, _mm_set1_ps(scale)), _mm_setzero_ps()), _mm_set1_ps(scale));
+		_mm_storeu_si128((__m128i*)index, _mm_cvtps_epi32(v));
+#else
+		index[0] = (int)(std::min(std::max(p[j].r, 0.0f), 1.0f) * scale + 0.5f);
+		index[1] = (int)(std::min(std::max(p[j].g, 0.0f), 1.0f) * scale + 0.5f);
+		index[2] = (int)(std::min(std::max(p[j].b, 0.0f), 1.0f) * scale + 0.5f);
+#endif
+		p[j].r = t.codes[t.encode[index[0]]];
+		p[j].g = t.codes[t.encode[index[1]]];
+		p[j].b = t.codes[t.encode[index[2]]];
+	}
+}
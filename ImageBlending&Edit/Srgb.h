@@ -0,0 +1,19 @@
+#pragma once
+#include "Pixel.h"
+
+// sRGB <-> linear light through tables, built on first use: 256 floats
+// decode an 8-bit sRGB value, 4096 bytes encode a linear value, so no
+// pow is evaluated per pixel. Alpha is left alone.
+
+// The linear value of 8-bit sRGB code v.
+float SrgbToLinear(unsigned char v);
+
+// The nearest 8-bit sRGB code of linear value v in [0, 1]; within one
+// step of the exact encoding.
+unsigned char LinearToSrgb(float v);
+
+// Converts the colors of n pixels in place. Decoding takes each channel
+// to its nearest 8-bit code first, which is exact for colors read from
+// an 8-bit file; encoding leaves each channel at code / 255.
+void DecodeSrgbScanline(pixel* p, int n);
+void EncodeSrgbScanline(pixel* p, int n);